@@ -14,8 +14,10 @@ class CVimToDatasmith::CActorEntry {
     bool HasElement() const { return mActorElement.IsValid(); }
 
     void SetActor(const TSharedRef<IDatasmithActorElement>& inActorElement, NodeIndex inNodeIndex) {
-        if (inNodeIndex < mLowestNodeIndex)
+        if (inNodeIndex < mLowestNodeIndex) {
             mActorElement = inActorElement;
+            mLowestNodeIndex = inNodeIndex;
+        }
         TestAssert(mActorElement.IsValid());
     }
 
@@ -2,7 +2,9 @@
 // Licensed under the MIT License 1.0
 
 #include "CConvertVimToDatasmith.h"
+#include "CTaskGraph.h"
 #include "CVimToDatasmith.h"
+#include "SystemResources.h"
 
 DISABLE_SDK_WARNINGS_START
 
@@ -17,6 +19,10 @@ DISABLE_SDK_WARNINGS_START
 
 DISABLE_SDK_WARNINGS_END
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
 namespace Vim2Ds {
 
 CConvertVimToDatasmith::CConvertVimToDatasmith() {
@@ -25,14 +31,38 @@ CConvertVimToDatasmith::CConvertVimToDatasmith() {
 CConvertVimToDatasmith::~CConvertVimToDatasmith() {
 }
 
+// Each worker is a thread with it's own deque, more would exhaust the system before being useful
+static const uint64_t kMaxThreads = 1024;
+
+// Memory budgets are converted to bytes
+static const uint64_t kMaxMemoryMB = UINT64_MAX >> 20;
+
+// Parse a strictly positive count, up to inMax, given by a parameter or an environment variable
+static uint64_t ParseCount(const utf8_t* inText, const utf8_t* inName, uint64_t inMax) {
+    char* end = nullptr;
+    unsigned long long count = strtoull(inText, &end, 10);
+    if (end == inText || *end != 0 || count == 0 || count > inMax) {
+        DebugF("Invalid %s value \"%s\" (1 to %llu)\n", inName, inText, (unsigned long long)inMax);
+        Usage();
+    }
+    return count;
+}
+
 // Parse parameters to get Vim file path and datasmith file path
 void CConvertVimToDatasmith::GetParameters(int argc, const utf8_t* const* argv) {
-    if (argc > 1 && argv[1][0] == '-') {
-        if (strcmp(argv[1], "-NoHierarchicalInstance") == 0) {
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-NoHierarchicalInstance") == 0)
             mNoHierarchicalInstance = true;
-            --argc;
-            ++argv;
-        }
+        else if (strncmp(argv[1], "-Threads=", 9) == 0)
+            mThreadsCount = unsigned(ParseCount(argv[1] + 9, "-Threads", kMaxThreads));
+        else if (strncmp(argv[1], "-MemoryMB=", 10) == 0)
+            mMemoryBudgetMB = ParseCount(argv[1] + 10, "-MemoryMB", kMaxMemoryMB);
+        else if (strcmp(argv[1], "-PinThreads") == 0)
+            mPinThreads = true;
+        else
+            Usage();
+        --argc;
+        ++argv;
     }
 
     if (argc < 2 || argc > 3)
@@ -65,39 +95,99 @@ void CConvertVimToDatasmith::GetParameters(int argc, const utf8_t* const* argv)
     mOutputPath = UTF8_TO_TCHAR((mDatasmithFolderPath + "/" + mDatasmithFileName + "_Assets").c_str());
 
     DebugF("Convert \"%s\" -> \"%s\"\n", mVimFilePath.c_str(), (mDatasmithFolderPath + "/" + mDatasmithFileName + ".udatasmith").c_str());
-}
-
-void CConvertVimToDatasmith::Convert() {
-    mTotalTimeStat.BeginNow();
-    CTaskMgr::CTaskJointer jointer("CConvertVimToDatasmith::Convert");
-
-    CreateScene();
 
-    ReadVimFile();
-    mVimTodatasmith.reset(new CVimToDatasmith(this));
+    SetupTaskMgr();
+}
 
-    mVimPrepareStat.BeginNow();
-    (new CTaskMgr::TJoinableFunctorTask<CVimImported*>([](CVimImported* inVimImporter) { inVimImporter->Prepare(); }, mVim.get()))->Start(&jointer);
-    (new CTaskMgr::TJoinableFunctorTask<CVimToDatasmith*>([](CVimToDatasmith* inVimTodatasmith) { inVimTodatasmith->CreateMaterials(); },
-                                                          mVimTodatasmith.get()))
-        ->Start(&jointer);
-    jointer.Join();
-    mVimPrepareStat.FinishNow();
+// Size the task manager from the processors and memory we may use, or the user's overrides
+void CConvertVimToDatasmith::SetupTaskMgr() {
+    CTaskMgr::SSettings settings;
+
+    // Workers: -Threads, VIM2DS_THREADS or the processors we may use (container quota and cpuset)
+    unsigned availableProcessors = GetAvailableProcessors();
+    settings.mWorkersCount = mThreadsCount;
+    const utf8_t* threadsVariable = getenv("VIM2DS_THREADS");
+    if (settings.mWorkersCount == 0 && threadsVariable != nullptr && *threadsVariable != 0)
+        settings.mWorkersCount = unsigned(ParseCount(threadsVariable, "VIM2DS_THREADS", kMaxThreads));
+    if (settings.mWorkersCount == 0)
+        settings.mWorkersCount = availableProcessors;
+
+    // Memory budget: -MemoryMB, VIM2DS_MEMORY_MB or the memory we may use (container limit)
+    uint64_t memoryBudget = mMemoryBudgetMB << 20;
+    const utf8_t* memoryVariable = getenv("VIM2DS_MEMORY_MB");
+    if (memoryBudget == 0 && memoryVariable != nullptr && *memoryVariable != 0)
+        memoryBudget = ParseCount(memoryVariable, "VIM2DS_MEMORY_MB", kMaxMemoryMB) << 20;
+    if (memoryBudget == 0)
+        memoryBudget = GetAvailableMemory();
+
+    // Queued I/O tasks keep their mesh in memory, about one by 64MB of budget
+    if (memoryBudget != 0)
+        settings.mMaxQueuedIOTasks = size_t(std::min(std::max(memoryBudget >> 26, uint64_t(4)), uint64_t(64)));
+
+    settings.mPinWorkers = mPinThreads;
+    CTaskMgr::SetSettings(settings);
+    TraceF("CConvertVimToDatasmith::SetupTaskMgr - %u workers (%u processors available)%s, memory budget %lluMB, %u queued I/O tasks\n",
+           settings.mWorkersCount, availableProcessors, settings.mPinWorkers ? " pinned" : "", (unsigned long long)(memoryBudget >> 20),
+           unsigned(settings.mMaxQueuedIOTasks));
+}
 
-    mVimTodatasmith->ConvertScene();
+// Run the conversion steps, each one start as soon as the steps it depends on are done
+void CConvertVimToDatasmith::Convert() {
+    typedef CTaskGraph::NodeId NodeId;
+    mConvertGraph.reset(new CTaskGraph("CConvertVimToDatasmith::Convert"));
+    CTaskGraph& graph = *mConvertGraph;
+
+    // Reading: each section is decoded by it's own node, so the stages using a section start as soon as it's decoded
+    NodeId createScene = graph.AddNode("CreateScene", CTaskGraph::kRunOnWorker, {}, [this] { CreateScene(); });
+    NodeId openVimFile = graph.AddNode("OpenVimFile", CTaskGraph::kRunOnCaller, {}, [this] { OpenVimFile(); });
+    NodeId readGeometry = graph.AddNode("ReadGeometry", CTaskGraph::kRunOnWorker, {openVimFile}, [this] { mVim->ReadGeometry(); });
+    NodeId readStrings = graph.AddNode("ReadStrings", CTaskGraph::kRunOnWorker, {openVimFile}, [this] { mVim->ReadStrings(); });
+    NodeId readNodeTable = graph.AddNode("ReadNodeTable", CTaskGraph::kRunOnWorker, {openVimFile}, [this] { mVim->ReadTable("table:Vim.Node"); });
+    NodeId readElementTable = graph.AddNode("ReadElementTable", CTaskGraph::kRunOnWorker, {openVimFile}, [this] { mVim->ReadTable("table:Rvt.Element"); });
+    NodeId readMaterialTable = graph.AddNode("ReadMaterialTable", CTaskGraph::kRunOnWorker, {openVimFile}, [this] { mVim->ReadTable("table:Rvt.Material"); });
+    NodeId doneReading =
+        graph.AddNode("DoneReading", CTaskGraph::kRunOnWorker, {readGeometry, readStrings, readNodeTable, readElementTable, readMaterialTable},
+                      [this] {
+                          mVim->DoneReading();
+                          mVimLoadStat.FinishNow();
+                      });
+
+    // Preparation: the geometry and it's normals are prepared while the strings and the tables are decoded.
+    // Materials need the reachability computed by PrepareGeometry, they are created while the normals are computed
+    NodeId prepareGeometry = graph.AddNode("PrepareGeometry", CTaskGraph::kRunOnCaller, {readGeometry}, [this] {
+        mVimPrepareStat.BeginNow();
+        mVim->PrepareGeometry();
+    });
+    NodeId prepareElements = graph.AddNode("PrepareElements", CTaskGraph::kRunOnWorker, {readNodeTable, readElementTable}, [this] { mVim->PrepareElements(); });
+    NodeId createMaterials = graph.AddNode("CreateMaterials", CTaskGraph::kRunOnWorker, {prepareGeometry, readStrings, readMaterialTable},
+                                           [this] { mVimTodatasmith->CreateMaterials(); });
+    NodeId prepareNormals = graph.AddNode("PrepareNormals", CTaskGraph::kRunOnCaller, {prepareGeometry}, [this] { mVim->PrepareNormals(); });
+
+    // Scene conversion (after DoneReading, the vim scene is deleted once the scene is done)
+    NodeId convertGeometries = graph.AddNode("ConvertGeometries", CTaskGraph::kRunOnCaller,
+                                             {createScene, createMaterials, prepareNormals, prepareElements, doneReading}, [this] {
+                                                 mVimPrepareStat.FinishNow();
+                                                 mVim->PrintStats();
+                                                 mBuildMeshTimeStat.BeginNow();
+                                                 mVimTodatasmith->ConvertGeometries();
+                                                 mBuildMeshTimeStat.FinishNow();
+                                             });
+    NodeId addUsedMaterials = graph.AddNode("AddUsedMaterials", CTaskGraph::kRunOnWorker, {convertGeometries}, [this] { mVimTodatasmith->AddUsedMaterials(); });
+    NodeId createAllMetaDatas =
+        graph.AddNode("CreateAllMetaDatas", CTaskGraph::kRunOnCaller, {convertGeometries}, [this] { mVimTodatasmith->CreateAllMetaDatas(); });
+    NodeId createAllTags = graph.AddNode("CreateAllTags", CTaskGraph::kRunOnWorker, {convertGeometries}, [this] { mVimTodatasmith->CreateAllTags(); });
 
     // Deletion, validation and writing
-    (new CTaskMgr::TJoinableFunctorTask<CConvertVimToDatasmith*>([](CConvertVimToDatasmith* me) { me->mVimTodatasmith.reset(); }, this))->Start(&jointer);
-    (new CTaskMgr::TJoinableFunctorTask<CConvertVimToDatasmith*>([](CConvertVimToDatasmith* me) { me->mVim.reset(); }, this))->Start(&jointer);
-    (new CTaskMgr::TJoinableFunctorTask<CConvertVimToDatasmith*>(
-         [](CConvertVimToDatasmith* me) {
-             me->Validate();
-             me->CreateDatasmithFile();
-         },
-         this))
-        ->Start(&jointer);
-    jointer.Join();
+    std::initializer_list<NodeId> sceneDone = {addUsedMaterials, createAllMetaDatas, createAllTags};
+    graph.AddNode("DeleteConverter", CTaskGraph::kRunOnWorker, sceneDone, [this] { mVimTodatasmith.reset(); });
+    graph.AddNode("DeleteVim", CTaskGraph::kRunOnWorker, sceneDone, [this] { mVim.reset(); });
+    graph.AddNode("WriteDatasmith", CTaskGraph::kRunOnWorker, sceneDone, [this] {
+        Validate();
+        CreateDatasmithFile();
+    });
 
+    mTotalTimeStat.BeginNow();
+    graph.Run();
     mTotalTimeStat.FinishNow();
     ReportTimeStat();
 }
@@ -110,11 +200,12 @@ void CConvertVimToDatasmith::CreateScene() {
     mDatasmithScene->SetProductVersion(UTF8_TO_TCHAR("1.0.0"));
 }
 
-void CConvertVimToDatasmith::ReadVimFile() {
+// Open the vim file, it's sections are decoded by the conversion graph nodes
+void CConvertVimToDatasmith::OpenVimFile() {
     mVimLoadStat.BeginNow();
     mVim.reset(new CVimImported());
-    mVim->Read(mVimFilePath);
-    mVimLoadStat.FinishNow();
+    mVim->Open(mVimFilePath);
+    mVimTodatasmith.reset(new CVimToDatasmith(this));
 }
 
 // Write a Datasmith scene to the Datasmith file
@@ -163,9 +254,12 @@ void CConvertVimToDatasmith::ReportTimeStat() {
     mVimPrepareStat.PrintTime("Prepare");
     mBuildMeshTimeStat.PrintTime("Mesh");
     mBuildMetaDataTimeStat.PrintTime("MetaData");
-    mBuildMetaDataTimeStat.PrintTime("Tags");
+    mBuildTagsTimeStat.PrintTime("Tags");
     mValidationTimeStat.PrintTime("Validation");
     mWriteTimeStat.PrintTime("Write");
+    if (mConvertGraph)
+        mConvertGraph->PrintReport(kP2DB_Trace);
+    CTaskMgr::Get().PrintStats(kP2DB_Trace);
     SetPrintLevel(tmp);
 }
 
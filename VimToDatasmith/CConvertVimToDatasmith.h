@@ -18,6 +18,7 @@ namespace Vim2Ds {
 
 class CVimImported;
 class CVimToDatasmith;
+class CTaskGraph;
 
 class CConvertVimToDatasmith {
   public:
@@ -43,15 +44,21 @@ class CConvertVimToDatasmith {
     FTimeStat mBuildTagsTimeStat;
 
   private:
+    // Size the task manager from the processors and memory we may use, or the user's overrides
+    void SetupTaskMgr();
+
     // Main steps of the conversion
     void CreateScene();
-    void ReadVimFile();
+    void OpenVimFile();
     void Validate();
     void CreateDatasmithFile();
     void ReportTimeStat();
 
     // Extracted from parameters
     bool mNoHierarchicalInstance = false;
+    unsigned mThreadsCount = 0; // 0: from VIM2DS_THREADS or the available processors
+    uint64_t mMemoryBudgetMB = 0; // 0: from VIM2DS_MEMORY_MB or the available memory
+    bool mPinThreads = false;
     std::string mVimFilePath;
     std::string mDatasmithFolderPath;
     std::string mDatasmithFileName;
@@ -60,6 +67,9 @@ class CConvertVimToDatasmith {
     std::unique_ptr<CVimImported> mVim;
     std::unique_ptr<CVimToDatasmith> mVimTodatasmith;
 
+    // Conversion steps and their dependencies (kept for the time report)
+    std::unique_ptr<CTaskGraph> mConvertGraph;
+
     // Datasmith scene and assets output path
     TSharedPtr<IDatasmithScene> mDatasmithScene;
     std::mutex mDatasmithSceneAccessControl;
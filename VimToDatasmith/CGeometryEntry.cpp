@@ -15,7 +15,10 @@ DISABLE_SDK_WARNINGS_START
 
 DISABLE_SDK_WARNINGS_END
 
+#include <algorithm>
+#include <exception>
 #include <iostream>
+#include <unordered_map>
 
 namespace Vim2Ds {
 
@@ -37,36 +40,113 @@ CVimToDatasmith::CGeometryEntry::CGeometryEntry(CVimToDatasmith* inVimToDatasmit
 : mVimToDatasmith(inVimToDatasmith)
 , mGeometry(inGeometry)
 , mDefinition(inDefinition) {
-    CTaskMgr::Get().AddTask(this);
 }
 
+// Start the task converting the geometry and creating it's actors (all instances must have been added)
+void CVimToDatasmith::CGeometryEntry::Start(CTaskMgr::CTaskJointer* inJointer) {
+    mJointer = inJointer;
+    mJointer->StartTask([this]() { Run(); });
+}
+
+// Dense remap of the vim vertices used by a geometry to the mesh vertices. Each thread keeps it's own and reuse it for
+// all the geometries it converts, so remapping doesn't hash nor allocate once the arrays are large enough.
+// Geometries spanning more than kMaxDenseVertices (sharing far vertices) are remapped by a hash map, released after use,
+// so the arrays kept by each thread don't exceed kMaxDenseVertices.
+class CMeshVerticesRemap {
+  public:
+    static const size_t kMaxDenseVertices = 1024 * 1024;
+
+    // Start remapping the geometry vertices in [inFirstVertex, inEndVertex[ (clear the previous geometry ones)
+    void Begin(VertexIndex inFirstVertex, VertexIndex inEndVertex) {
+        if (mIsDense) {
+            for (VertexIndex vertex : mMeshVertices)
+                mVertexToMeshVertex[vertex - mFirstVertex] = -1;
+        } else
+            std::unordered_map<VertexIndex, int32_t>().swap(mSparseVertexToMeshVertex);
+        if (mMeshVertices.capacity() > kMaxDenseVertices)
+            std::vector<VertexIndex>().swap(mMeshVertices);
+        mMeshVertices.clear();
+        mFirstVertex = inFirstVertex;
+        size_t rangeSize = size_t(inEndVertex - inFirstVertex);
+        mIsDense = rangeSize <= kMaxDenseVertices;
+        if (mIsDense && mVertexToMeshVertex.size() < rangeSize)
+            mVertexToMeshVertex.resize(rangeSize, -1);
+    }
+
+    // Return the mesh vertex of the vim vertex, added on first use
+    int32_t AddVertex(VertexIndex inVertex) {
+        if (!mIsDense) {
+            auto insertResult = mSparseVertexToMeshVertex.insert({inVertex, int32_t(mMeshVertices.size())});
+            if (insertResult.second)
+                mMeshVertices.push_back(inVertex);
+            return insertResult.first->second;
+        }
+        int32_t& meshVertex = mVertexToMeshVertex[inVertex - mFirstVertex];
+        if (meshVertex < 0) {
+            meshVertex = int32_t(mMeshVertices.size());
+            mMeshVertices.push_back(inVertex);
+        }
+        return meshVertex;
+    }
+
+    // Return the mesh vertex of a vim vertex already added
+    int32_t GetMeshVertex(VertexIndex inVertex) const {
+        if (!mIsDense)
+            return mSparseVertexToMeshVertex.find(inVertex)->second;
+        return mVertexToMeshVertex[inVertex - mFirstVertex];
+    }
+
+    // Vim vertices of the mesh vertices
+    const std::vector<VertexIndex>& GetMeshVertices() const { return mMeshVertices; }
+
+  private:
+    VertexIndex mFirstVertex = VertexIndex(0);
+    bool mIsDense = true;
+    std::vector<int32_t> mVertexToMeshVertex; // Mesh vertex of the range vertices, -1 for unused ones
+    std::unordered_map<VertexIndex, int32_t> mSparseVertexToMeshVertex; // When the range is too large for the dense array
+    std::vector<VertexIndex> mMeshVertices; // In first use order
+};
+
+static thread_local CMeshVerticesRemap SMeshVerticesRemap;
+
 // Convert geometry to Datasmith Mesh
 void CVimToDatasmith::CGeometryEntry::ConvertGeometryToDatasmithMesh(FDatasmithMesh* outMesh,
                                                                      MapVimMaterialIdToDsMeshMaterialIndice* outVimMaterialIdToDsMeshMaterialIndice) {
     CVimImported& vim = mVimToDatasmith->mVim;
     outMesh->SetName(UTF8_TO_TCHAR(Utf8StringFormat("%d", mGeometry).c_str()));
 
-    // Collect vertex used by this geometry
-    std::unordered_map<VertexIndex, int32_t> vimIndiceToDsMeshIndice;
-    int32_t verticesCount = 0;
+    // Vertices range of this geometry, extended if it's indices refer to vertices of other geometries
     IndiceIndex indicesStart = vim.mGroupIndexOffets[mGeometry];
     IndiceIndex indicesEnd = IndiceIndex(indicesStart + vim.mGroupIndexCounts[mGeometry]);
-    for (IndiceIndex index = indicesStart; index < indicesEnd; index = IndiceIndex(index + 1)) {
+    VertexIndex firstVertex = vim.mGroupVertexOffets[mGeometry];
+    VertexIndex endVertex =
+        mGeometry + 1 < vim.mGroupVertexOffets.Count() ? vim.mGroupVertexOffets[GeometryIndex(mGeometry + 1)] : vim.mPositions.Count();
+    endVertex = std::max(firstVertex, endVertex);
+    for (IndiceIndex index = indicesStart; index < indicesEnd; Increment(index)) {
         VertexIndex vertexIndex = vim.mIndices[index];
-        if (vimIndiceToDsMeshIndice.find(vertexIndex) == vimIndiceToDsMeshIndice.end())
-            vimIndiceToDsMeshIndice[vertexIndex] = verticesCount++;
+        firstVertex = std::min(firstVertex, vertexIndex);
+        endVertex = std::max(endVertex, VertexIndex(vertexIndex + 1));
     }
 
+    // Collect vertex used by this geometry (mesh vertices are in first use order)
+    CMeshVerticesRemap& remap = SMeshVerticesRemap;
+    remap.Begin(firstVertex, endVertex);
+    for (IndiceIndex index = indicesStart; index < indicesEnd; Increment(index))
+        remap.AddVertex(vim.mIndices[index]);
+
     // Copy used vertex to the mesh
-    outMesh->SetVerticesCount(verticesCount);
-    for (const auto& iter : vimIndiceToDsMeshIndice) {
-        const cVec3& position = vim.mPositions[iter.first];
-        outMesh->SetVertex(iter.second, position.x * Meter2Centimeter, -position.y * Meter2Centimeter, position.z * Meter2Centimeter);
+    const std::vector<VertexIndex>& meshVertices = remap.GetMeshVertices();
+    outMesh->SetVerticesCount(int32_t(meshVertices.size()));
+    for (int32_t meshVertex = 0; meshVertex < int32_t(meshVertices.size()); ++meshVertex) {
+        const cVec3& position = vim.mPositions[meshVertices[meshVertex]];
+        outMesh->SetVertex(meshVertex, position.x * Meter2Centimeter, -position.y * Meter2Centimeter, position.z * Meter2Centimeter);
     }
 
-    // Collect materials used by this geometry
+    // Collect materials used by this geometry (consecutive faces mostly share their material)
     int32_t materialsCount = 0;
     FaceIndex vimMaterial = FaceIndex(indicesStart / 3);
+    MaterialId previousMaterialId = kInvalidMaterial;
+    int32_t meshMaterialIndex = -1;
 
     // Copy faces used by this geometry
     int32_t facesCount = vim.mGroupIndexCounts[mGeometry] / 3;
@@ -90,10 +170,14 @@ void CVimToDatasmith::CGeometryEntry::ConvertGeometryToDatasmithMesh(FDatasmithM
                     DebugF("CVimToDatasmith::CGeometryEntry::ConvertGeometryToDatasmithMesh - Report limit of 10 reached\n");
             }
 #endif
-        auto insertResult = outVimMaterialIdToDsMeshMaterialIndice->insert({vimMaterialId, materialsCount});
         vimMaterial = FaceIndex(vimMaterial + 1);
-        if (insertResult.second)
-            ++materialsCount;
+        if (vimMaterialId != previousMaterialId || meshMaterialIndex < 0) {
+            auto insertResult = outVimMaterialIdToDsMeshMaterialIndice->insert({vimMaterialId, materialsCount});
+            if (insertResult.second)
+                ++materialsCount;
+            previousMaterialId = vimMaterialId;
+            meshMaterialIndex = insertResult.first->second;
+        }
 
         // Get the face local vertices index.
         int32_t triangleVertices[3];
@@ -101,12 +185,12 @@ void CVimToDatasmith::CGeometryEntry::ConvertGeometryToDatasmithMesh(FDatasmithM
         for (int i = 0; i < 3; ++i) {
             VertexIndex indice = vim.mIndices[vimIndice];
             vimIndice = IndiceIndex(vimIndice + 1);
-            triangleVertices[i] = vimIndiceToDsMeshIndice[indice];
-            const cVec3& normal = vim.mNormals[indice];
+            triangleVertices[i] = remap.GetMeshVertex(indice);
+            const cVec3& normal = (*vim.mNormals)[indice];
             outMesh->SetNormal(indexFace * 3 + i, normal.x, -normal.y, normal.z);
         }
 
-        outMesh->SetFace(indexFace, triangleVertices[0], triangleVertices[1], triangleVertices[2], insertResult.first->second);
+        outMesh->SetFace(indexFace, triangleVertices[0], triangleVertices[1], triangleVertices[2], meshMaterialIndex);
 
         /*
          int32_t triangleUVs[3];
@@ -118,15 +202,15 @@ void CVimToDatasmith::CGeometryEntry::ConvertGeometryToDatasmithMesh(FDatasmithM
 
 // Process the node's geometry (create datasmith mesh)
 void CVimToDatasmith::CGeometryEntry::Run() {
-    FDatasmithMesh datasmithMesh;
+    std::unique_ptr<FDatasmithMesh> datasmithMesh(new FDatasmithMesh());
     MapVimMaterialIdToDsMeshMaterialIndice vimMaterialIdToDsMeshMaterialIndice;
-    ConvertGeometryToDatasmithMesh(&datasmithMesh, &vimMaterialIdToDsMeshMaterialIndice);
+    ConvertGeometryToDatasmithMesh(datasmithMesh.get(), &vimMaterialIdToDsMeshMaterialIndice);
 
     // If material list isn't empty -> We have at least 1 face
     if (!vimMaterialIdToDsMeshMaterialIndice.empty()) {
         // Create an mesh id based on mesh content
         Datasmith::FDatasmithHash meshHasher;
-        meshHasher.ComputeDatasmithMeshHash(datasmithMesh);
+        meshHasher.ComputeDatasmithMeshHash(*datasmithMesh);
         FMD5Hash meshHash = meshHasher.GetHashValue();
         CMD5Hash meshMD5Hash(meshHash);
 
@@ -144,12 +228,59 @@ void CVimToDatasmith::CGeometryEntry::Run() {
             meshDefinition = insertResult.first->second.get();
         }
         if (isNewDefinition) {
-            // We are the first, so we initialize the definition
-            datasmithMesh.SetName(*LexToString(meshHash));
-            mMeshElement = meshDefinition->Initialize(datasmithMesh, vimMaterialIdToDsMeshMaterialIndice, *mVimToDatasmith);
-        } else // We are a new element of this definition
-            mMeshElement = meshDefinition->GetOrCreateMeshElement(vimMaterialIdToDsMeshMaterialIndice, *mVimToDatasmith);
+            // We are the first, so we initialize the definition. It's file is written by an I/O task, meanwhile this
+            // worker convert other geometries.
+            datasmithMesh->SetName(*LexToString(meshHash));
+            mMeshToExport = std::move(datasmithMesh);
+            mMaterialsToExport = std::move(vimMaterialIdToDsMeshMaterialIndice);
+            mJointer->StartIOTask([this, meshDefinition]() { ExportMesh(meshDefinition); });
+            return;
+        }
+
+        // We are a new element of this definition
+        mMeshElement = meshDefinition->GetOrCreateMeshElement(vimMaterialIdToDsMeshMaterialIndice, *mVimToDatasmith);
+
+        // If the definition is still initialized by an other geometry, it will create our actors
+        std::unique_lock<std::mutex> lk(mVimToDatasmith->mDefinitionsAccessControl);
+        if (!meshDefinition->IsInitializedOrWait(this))
+            return;
+    }
+
+    // Actors are created as soon as the mesh is, while other geometries are still converted
+    CreateActors();
+}
+
+// Write the mesh file of our new definition (on an I/O thread), then create the actors waiting for it
+void CVimToDatasmith::CGeometryEntry::ExportMesh(CMeshDefinition* inDefinition) {
+    // On failure, the waiting geometries are still released (without mesh they get no actor), then the
+    // exception is rethrown to be reported by the jointer.
+    std::exception_ptr exportException;
+    try {
+        mMeshElement = inDefinition->Initialize(*mMeshToExport, mMaterialsToExport, *mVimToDatasmith);
+    } catch (std::exception& e) {
+        DebugF("CVimToDatasmith::CGeometryEntry::ExportMesh - Geometry %u, export failed: %s\n", mGeometry, e.what());
+        exportException = std::current_exception();
+    } catch (...) {
+        DebugF("CVimToDatasmith::CGeometryEntry::ExportMesh - Geometry %u, export failed\n", mGeometry);
+        exportException = std::current_exception();
     }
+    mMeshToExport.reset();
+    mMaterialsToExport.clear();
+
+    // Actors are created by a worker, with the actors of the geometries that was waiting for this definition
+    mJointer->StartTask([this, inDefinition]() {
+        std::vector<CGeometryEntry*> waitingGeometries;
+        {
+            std::unique_lock<std::mutex> lk(mVimToDatasmith->mDefinitionsAccessControl);
+            waitingGeometries = inDefinition->SetInitialized();
+        }
+        for (CGeometryEntry* geometry : waitingGeometries)
+            geometry->CreateActors();
+        CreateActors();
+    });
+
+    if (exportException)
+        std::rethrow_exception(exportException);
 }
 
 // We add instance -> IDatasmithHierarchicalInstancedStaticMeshActorElement
@@ -160,28 +291,14 @@ void CVimToDatasmith::CGeometryEntry::AddInstance(NodeIndex inInstance) {
         mInstances->push_back(inInstance);
 }
 
-FString CVimToDatasmith::CGeometryEntry::HashToName(Datasmith::FDatasmithHash& hasher, NodeIndex inInstance) const {
+// Create the actor name based on it's content
+FString CVimToDatasmith::CGeometryEntry::HashToName(Datasmith::FDatasmithHash& hasher) const {
     // Hash mesh name
     const IDatasmithMeshElement* meshElement = mMeshElement->GetMeshElement(*mVimToDatasmith);
     hasher.MyMD5.Update((const unsigned char*)meshElement->GetName(), FCString::Strlen(meshElement->GetName()) * sizeof(TCHAR));
 
     FMD5Hash actorHash = hasher.GetHashValue();
-    FString actorName(LexToString(actorHash));
-
-    // Validate actor name unicity (or make-it)
-    utf8_string tmpName(TCHAR_TO_UTF8(*actorName));
-    auto insertResult = mVimToDatasmith->mMapInstancesNameToGeometry.insert({tmpName, this});
-    if (!insertResult.second) {
-        uint32_t occurence = 1;
-        do {
-            utf8_string occurenceName = Utf8StringFormat("%s_Occurence_%d", tmpName.c_str(), ++occurence);
-            insertResult = mVimToDatasmith->mMapInstancesNameToGeometry.insert({occurenceName, this});
-        } while (!insertResult.second);
-        actorName = UTF8_TO_TCHAR(insertResult.first->first.c_str());
-        VerboseF("Duplicate actor name %s - instance %u\n", insertResult.first->first.c_str(), inInstance);
-    }
-
-    return actorName;
+    return LexToString(actorHash);
 }
 
 // Finalize actor initialization and add it to the scene
@@ -189,10 +306,15 @@ void CVimToDatasmith::CGeometryEntry::AddActor(const TSharedRef<IDatasmithMeshAc
     inActor->SetStaticMeshPathName(mMeshElement->GetMeshElement(*mVimToDatasmith)->GetName());
 
     ElementIndex elementIndex = mVimToDatasmith->mVim.mVimNodeToVimElement[inInstance];
-    if (elementIndex != ElementIndex::kNoElement) {
-        mVimToDatasmith->mVecElementToActors[elementIndex].SetActor(inActor, inInstance);
-        inActor->SetLabel(UTF8_TO_TCHAR(mVimToDatasmith->mVim.GetString(mVimToDatasmith->mVim.mElementToName[elementIndex])));
-    } else
+    {
+        std::unique_lock<std::mutex> lk(mVimToDatasmith->mActorsAccessControl);
+        mVimToDatasmith->RegisterActorName(inActor, inInstance);
+        if (elementIndex != ElementIndex::kNoElement)
+            mVimToDatasmith->mVecElementToActors[elementIndex].SetActor(inActor, inInstance);
+    }
+    if (elementIndex != ElementIndex::kNoElement)
+        inActor->SetLabel(mVimToDatasmith->mVim.GetTCharString(mVimToDatasmith->mVim.mElementToName[elementIndex]));
+    else
         DebugF("CVimToDatasmith::CGeometryEntry::CreateActor - Invalid element (instance=%u)\n", inInstance);
 
     if (!*inActor->GetLabel())
@@ -216,7 +338,7 @@ void CVimToDatasmith::CGeometryEntry::CreateActor(NodeIndex inInstance) {
     hasher.HashFixVector(actorTransfo.GetTranslation());
     hasher.HashScaleVector(actorTransfo.GetScale3D());
 
-    FString actorName(HashToName(hasher, inInstance));
+    FString actorName(HashToName(hasher));
 
     // Create the actor
     TSharedRef<IDatasmithMeshActorElement> meshActor(FDatasmithSceneFactory::CreateMeshActor(*actorName));
@@ -249,7 +371,7 @@ void CVimToDatasmith::CGeometryEntry::CreateHierarchicalInstancesActor() {
         hasher.HashScaleVector(instanceTransfo.GetScale3D());
     }
 
-    FString actorName(HashToName(hasher, mDefinition));
+    FString actorName(HashToName(hasher));
 
     // Create the actor
     auto hierarchicalMeshActor(FDatasmithSceneFactory::CreateHierarchicalInstanceStaticMeshActor(*actorName));
@@ -267,7 +389,12 @@ void CVimToDatasmith::CGeometryEntry::CreateHierarchicalInstancesActor() {
 
 // Creat all actor using this geometry
 void CVimToDatasmith::CGeometryEntry::CreateActors() {
-    const IDatasmithMeshElement* meshElement = mMeshElement != nullptr ? mMeshElement->GetMeshElement(*mVimToDatasmith) : nullptr;
+    // Mesh elements are shared by geometries, so only one can create it
+    const IDatasmithMeshElement* meshElement = nullptr;
+    if (mMeshElement != nullptr) {
+        std::lock_guard<std::mutex> lock(mVimToDatasmith->mMeshElementsAccessControl);
+        meshElement = mMeshElement->GetMeshElement(*mVimToDatasmith);
+    }
     if (meshElement != nullptr) {
         if (mInstances == nullptr)
             CreateActor(mDefinition);
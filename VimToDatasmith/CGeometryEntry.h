@@ -3,10 +3,16 @@
 
 #include "CVimToDatasmith.h"
 
+DISABLE_SDK_WARNINGS_START
+
+#include "DatasmithMesh.h"
+
+DISABLE_SDK_WARNINGS_END
+
 namespace Vim2Ds {
 
 // GeometryEntry is a definition and an array of instances
-class CVimToDatasmith::CGeometryEntry : CTaskMgr::ITask {
+class CVimToDatasmith::CGeometryEntry {
   public:
     // Constructor
     CGeometryEntry(CVimToDatasmith* inVimToDatasmith, GeometryIndex inGeometry, NodeIndex inDefinition);
@@ -14,13 +20,19 @@ class CVimToDatasmith::CGeometryEntry : CTaskMgr::ITask {
     // Add an instance.
     void AddInstance(NodeIndex inInstance);
 
-    // Create Datasmith actors
-    void CreateActors();
+    // Start the task converting the geometry and creating it's actors (all instances must have been added)
+    void Start(CTaskMgr::CTaskJointer* inJointer);
 
   private:
-    // Process the node's geometry (create datasmith mesh)
+    // Process the node's geometry (create datasmith mesh), then it's actors
     void Run();
 
+    // Write the mesh file of our new definition (on an I/O thread), then create the actors waiting for it
+    void ExportMesh(CMeshDefinition* inDefinition);
+
+    // Create Datasmith actors
+    void CreateActors();
+
     // Convert geometry to Datasmith Mesh
     void ConvertGeometryToDatasmithMesh(FDatasmithMesh* outMesh, MapVimMaterialIdToDsMeshMaterialIndice* outVimMaterialIdToDsMeshMaterialIndice);
 
@@ -33,14 +45,19 @@ class CVimToDatasmith::CGeometryEntry : CTaskMgr::ITask {
     // Create an efficient actor for the specified instance
     void CreateHierarchicalInstancesActor();
 
-    // Create the actor name based on it's content (take care of duplicates)
-    FString HashToName(Datasmith::FDatasmithHash& hasher, NodeIndex inInstance) const;
+    // Create the actor name based on it's content
+    FString HashToName(Datasmith::FDatasmithHash& hasher) const;
 
     CVimToDatasmith* const mVimToDatasmith; // The converter
     CMeshElement* mMeshElement = nullptr; // The mesh element that is geometry and affected material.
     GeometryIndex mGeometry = GeometryIndex::kNoGeometry;
     NodeIndex mDefinition = NodeIndex::kNoNode; // First instance is considered as the definition
     std::unique_ptr<std::vector<NodeIndex>> mInstances; // All other instances (exclude definition one)
+    CTaskMgr::CTaskJointer* mJointer = nullptr; // Jointer of our tasks
+
+    // Mesh of our new definition and it's materials, kept until it's file is written
+    std::unique_ptr<FDatasmithMesh> mMeshToExport;
+    MapVimMaterialIdToDsMeshMaterialIndice mMaterialsToExport;
 };
 
 } // namespace Vim2Ds
@@ -21,7 +21,7 @@ class CVimToDatasmith::CMeshDefinition {
     // Constructor
     CMeshDefinition() {}
 
-    // Initialize the mesh (Create it's file in the assets folder)
+    // Initialize the mesh (Create it's file in the assets folder, called on an I/O thread)
     CMeshElement* Initialize(FDatasmithMesh& inMesh, const MapVimMaterialIdToDsMeshMaterialIndice& inVimMaterialIdToDsMeshMaterialIndice,
                              CVimToDatasmith& inVimToDatasmith) {
         TCHAR SubDir1[2] = {inMesh.GetName()[0], 0};
@@ -67,10 +67,27 @@ class CVimToDatasmith::CMeshDefinition {
     // Return the first element
     const CMeshElement* GetFirstElement() const { return mFirstElement; }
 
+    // Return true if initialized, otherwise inGeometry is kept until SetInitialized (mDefinitionsAccessControl must be locked)
+    bool IsInitializedOrWait(CGeometryEntry* inGeometry) {
+        if (!mIsInitialized)
+            mWaitingGeometries.push_back(inGeometry);
+        return mIsInitialized;
+    }
+
+    // Return the geometries that was waiting for the initialization (mDefinitionsAccessControl must be locked)
+    std::vector<CGeometryEntry*> SetInitialized() {
+        mIsInitialized = true;
+        return std::move(mWaitingGeometries);
+    }
+
   private:
     // We keep the first created mesh element to reuse it's values (name, dimensions) for next ones
     CMeshElement* mFirstElement = nullptr;
     std::unordered_map<CMD5Hash, std::unique_ptr<CMeshElement>, CMD5Hash::SHasher> mMapMaterialMD5ToMeshElement;
+
+    // Geometries that will create their actors once initialized
+    bool mIsInitialized = false;
+    std::vector<CGeometryEntry*> mWaitingGeometries;
 };
 
 // We define this function here to solve cross depedencies CMeshElement & CMeshDefinition
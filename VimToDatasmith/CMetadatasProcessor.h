@@ -3,6 +3,8 @@
 
 #include "CVimToDatasmith.h"
 
+#include <algorithm>
+
 namespace Vim2Ds {
 
 // Class distribut on threads the actor's metadata settings
@@ -11,65 +13,40 @@ class CVimToDatasmith::CMetadatasProcessor {
     // Constructor
     CMetadatasProcessor(CVimToDatasmith* inVimTodatasmith)
     : mVimTodatasmith(inVimTodatasmith)
-    , mProperties(inVimTodatasmith->mVim.GetEntitiesTable("table:Rvt.Element").mProperties) {
-        mStart = mProperties.size() > 0 ? &mProperties[0] : nullptr;
-        mEnd = mStart + mProperties.size();
+    , mElementsCount(uint32_t(inVimTodatasmith->mVecElementToActors.size())) {
+        // About 16 chunks by worker, so the workers finishing early can take the remaining ones
+        mChunkSize = std::max(uint32_t(kMinChunkSize), mElementsCount / (CTaskMgr::Get().GetNbProcessors() * 16));
     }
 
     // Process all
     void Process() {
-        CTaskMgr::CTaskJointer createAllMetaDatas("CreateAllMetaDatas");
-        for (unsigned i = 0; i < CTaskMgr::Get().GetNbProcessors(); ++i)
-            (new CTaskMgr::TJoinableFunctorTask<CMetadatasProcessor*>([](CMetadatasProcessor* me) { me->Proceed(); }, this))->Start(&createAllMetaDatas);
-        createAllMetaDatas.Join();
+        CTaskMgr::Get().ParallelFor(ElementIndex(0), ElementIndex(mElementsCount), mChunkSize,
+                                    [this](ElementIndex inStart, ElementIndex inEnd) { Proceed(inStart, inEnd); });
     }
 
   private:
-    // Process one actor at a time
-    void Proceed() {
-        const Vim::SerializableProperty* start;
-        const Vim::SerializableProperty* end;
-        CVimToDatasmith::CActorEntry* actorEntry = GetObject(&start, &end);
-        while (actorEntry != nullptr) {
-            while (start < end) {
-                TSharedPtr<IDatasmithKeyValueProperty> dsProperty =
-                    FDatasmithSceneFactory::CreateKeyValueProperty(UTF8_TO_TCHAR(mVimTodatasmith->mVim.GetString(StringIndex(start->mName))));
-                dsProperty->SetValue(UTF8_TO_TCHAR(mVimTodatasmith->mVim.GetString(StringIndex(start->mValue))));
-                dsProperty->SetPropertyType(EDatasmithKeyValuePropertyType::String);
-                actorEntry->GetOrCreateMetadataElement(mVimTodatasmith).AddProperty(dsProperty);
-                ++start;
+    // Process a chunk of consecutive elements
+    void Proceed(ElementIndex inStart, ElementIndex inEnd) {
+        const CVimImported& vim = mVimTodatasmith->mVim;
+        for (ElementIndex elementIndex = inStart; elementIndex < inEnd; Increment(elementIndex)) {
+            CVimToDatasmith::CActorEntry& actorEntry = mVimTodatasmith->mVecElementToActors[elementIndex];
+            if (actorEntry.HasElement()) {
+                vim.ForEachElementProperty(elementIndex, [this, &vim, &actorEntry](const Vim::SerializableProperty& inProperty) {
+                    TSharedPtr<IDatasmithKeyValueProperty> dsProperty =
+                        FDatasmithSceneFactory::CreateKeyValueProperty(vim.GetTCharString(StringIndex(inProperty.mName)));
+                    dsProperty->SetValue(vim.GetTCharString(StringIndex(inProperty.mValue)));
+                    dsProperty->SetPropertyType(EDatasmithKeyValuePropertyType::String);
+                    actorEntry.GetOrCreateMetadataElement(mVimTodatasmith).AddProperty(dsProperty);
+                });
             }
-            actorEntry = GetObject(&start, &end);
         }
     }
 
-    // Get the next actor to process
-    CVimToDatasmith::CActorEntry* GetObject(const Vim::SerializableProperty** outStart, const Vim::SerializableProperty** outEnd) {
-        std::unique_lock<std::mutex> lk(mAccessControl);
-        while (mStart < mEnd) {
-            ElementIndex elementIndex = ElementIndex(mStart->mEntityId);
-            *outStart = mStart;
-            ++mStart;
-            if (elementIndex < mVimTodatasmith->mVecElementToActors.size()) {
-                CVimToDatasmith::CActorEntry& actorEntry = mVimTodatasmith->mVecElementToActors[elementIndex];
-                if (actorEntry.HasElement()) {
-                    while (mStart < mEnd && ElementIndex(mStart->mEntityId) == elementIndex)
-                        ++mStart;
-                    *outEnd = mStart;
-                    return &actorEntry;
-                }
-            }
-        }
-        *outStart = nullptr;
-        *outEnd = nullptr;
-        return nullptr;
-    }
+    static const uint32_t kMinChunkSize = 64;
 
-    std::mutex mAccessControl;
-    const Vim::SerializableProperty* mStart;
-    const Vim::SerializableProperty* mEnd;
     CVimToDatasmith* const mVimTodatasmith;
-    const std::vector<Vim::SerializableProperty>& mProperties;
+    const uint32_t mElementsCount;
+    uint32_t mChunkSize;
 };
 
 } // namespace Vim2Ds
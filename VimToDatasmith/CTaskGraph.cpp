@@ -0,0 +1,234 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#include "CTaskGraph.h"
+#include "TimeStat.h"
+
+#include <stdexcept>
+
+namespace Vim2Ds {
+
+// Graph node
+struct CTaskGraph::SNode {
+    NodeId mId;
+    const utf8_t* mName;
+    ERunOn mRunOn;
+    std::function<void()> mWork;
+    std::vector<SNode*> mDependencies;
+    std::vector<SNode*> mDependents;
+
+    std::atomic<uint32_t> mPending; // Dependencies not done yet
+    std::atomic<bool> mSkip; // A dependency failed or was skipped
+    bool mFailed = false;
+    double mStartTime = 0.0;
+    double mFinishTime = 0.0;
+};
+
+// Constructor
+CTaskGraph::CTaskGraph(const utf8_t* inName)
+: mName(inName) {}
+
+// Destructor
+CTaskGraph::~CTaskGraph() {
+    // Run always reset it, even on exception (destructors must not throw)
+    if (mJointer != nullptr)
+        DebugF("CTaskGraph::~CTaskGraph - Graph %s is still running\n", mName);
+}
+
+// Add a node calling inWork() once all inDependencies are done
+CTaskGraph::NodeId CTaskGraph::AddNode(const utf8_t* inName, ERunOn inRunOn, std::initializer_list<NodeId> inDependencies,
+                                       std::function<void()> inWork) {
+    TestAssert(mJointer == nullptr && inWork);
+    NodeId id = NodeId(mNodes.size());
+    mNodes.emplace_back(new SNode());
+    SNode& node = *mNodes.back();
+    node.mId = id;
+    node.mName = inName;
+    node.mRunOn = inRunOn;
+    node.mWork = std::move(inWork);
+    for (NodeId dependency : inDependencies)
+        AddDependency(id, dependency);
+    return id;
+}
+
+// Add a dependency: inNode will start after inDependency is done
+void CTaskGraph::AddDependency(NodeId inNode, NodeId inDependency) {
+    TestAssert(mJointer == nullptr && inNode < mNodes.size() && inDependency < mNodes.size() && inNode != inDependency);
+    mNodes[inNode]->mDependencies.push_back(mNodes[inDependency].get());
+    mNodes[inDependency]->mDependents.push_back(mNodes[inNode].get());
+}
+
+// Run all nodes and wait until they are done (throw if a node failed)
+void CTaskGraph::Run() {
+    TestAssert(mJointer == nullptr);
+    if (mNodes.empty())
+        return;
+
+    // Reject cycles (some nodes would never be ready)
+    std::vector<uint32_t> pending(mNodes.size());
+    std::vector<SNode*> ready;
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+        pending[i] = uint32_t(mNodes[i]->mDependencies.size());
+        if (pending[i] == 0)
+            ready.push_back(mNodes[i].get());
+    }
+    size_t sortedCount = 0;
+    for (size_t i = 0; i < ready.size(); ++i, ++sortedCount) {
+        for (SNode* dependent : ready[i]->mDependents) {
+            if (--pending[dependent->mId] == 0)
+                ready.push_back(dependent);
+        }
+    }
+    if (sortedCount != mNodes.size())
+        ThrowMessage("CTaskGraph::Run - Graph %s has a dependency cycle", mName);
+
+    for (std::unique_ptr<SNode>& node : mNodes) {
+        node->mPending = uint32_t(node->mDependencies.size());
+        node->mSkip = false;
+        node->mFailed = false;
+    }
+    mRemaining = uint32_t(mNodes.size());
+    mFirstError.clear();
+    mCallerReady.clear();
+
+    // On exception, mJointer is reset once the jointer has waited for the started nodes (they may still schedule)
+    struct SJointerReset {
+        CTaskMgr::CTaskJointer*& mJointer;
+        ~SJointerReset() { mJointer = nullptr; }
+    } jointerReset{mJointer};
+    CTaskMgr::CTaskJointer jointer(mName);
+    mJointer = &jointer;
+    mStartTime = FTimeStat::RealTimeClock();
+    for (std::unique_ptr<SNode>& node : mNodes) {
+        if (node->mDependencies.empty())
+            ScheduleOrSkip(node.get());
+    }
+
+    // Run the caller's nodes until all nodes are done
+    {
+        std::unique_lock<std::mutex> lk(mAccessControl);
+        while (mRemaining != 0) {
+            if (mCallerReady.empty())
+                mCallerCondition.wait(lk, [this] { return !mCallerReady.empty() || mRemaining == 0; });
+            if (!mCallerReady.empty()) {
+                SNode* node = mCallerReady.back();
+                mCallerReady.pop_back();
+                lk.unlock();
+                Execute(node);
+                lk.lock();
+            }
+        }
+    }
+    jointer.Join();
+    mFinishTime = FTimeStat::RealTimeClock();
+
+    if (!mFirstError.empty())
+        ThrowMessage("CTaskGraph::Run - %s", mFirstError.c_str());
+}
+
+// The node can start (all dependencies done)
+void CTaskGraph::Schedule(SNode* inNode) {
+    if (inNode->mRunOn == kRunOnCaller) {
+        std::unique_lock<std::mutex> lk(mAccessControl);
+        mCallerReady.push_back(inNode);
+        mCallerCondition.notify_one();
+    } else {
+        // Nodes are pipeline stages, they must not wait behind the fine grained tasks of the other nodes
+        mJointer->StartTask([this, inNode]() { Execute(inNode); }, CTaskMgr::kPriorityHigh);
+    }
+}
+
+// Schedule the node, if it can't be it's done as failed (so the dependents are skipped and mRemaining still reach 0)
+void CTaskGraph::ScheduleOrSkip(SNode* inNode) {
+    utf8_string error;
+    try {
+        Schedule(inNode);
+        return;
+    } catch (std::exception& e) {
+        error = e.what();
+    } catch (...) {
+        error = "Unknown exception";
+    }
+    DebugF("CTaskGraph::ScheduleOrSkip - Node %s of %s can't be scheduled: %s\n", inNode->mName, mName, error.c_str());
+    {
+        std::unique_lock<std::mutex> lk(mAccessControl);
+        if (mFirstError.empty())
+            mFirstError = Utf8StringFormat("Node %s of %s can't be scheduled: %s", inNode->mName, mName, error.c_str());
+    }
+    inNode->mFailed = true;
+    inNode->mSkip = true;
+    Execute(inNode);
+}
+
+// Run the node work (unless skipped) and schedule the dependents that became ready
+void CTaskGraph::Execute(SNode* inNode) {
+    inNode->mStartTime = FTimeStat::RealTimeClock();
+    if (!inNode->mSkip) {
+        utf8_string error;
+        try {
+            inNode->mWork();
+        } catch (std::exception& e) {
+            error = e.what();
+        } catch (...) {
+            error = "Unknown exception";
+        }
+        if (!error.empty()) {
+            inNode->mFailed = true;
+            DebugF("CTaskGraph::Execute - Node %s of %s failed: %s\n", inNode->mName, mName, error.c_str());
+            std::unique_lock<std::mutex> lk(mAccessControl);
+            if (mFirstError.empty())
+                mFirstError = Utf8StringFormat("Node %s of %s failed: %s", inNode->mName, mName, error.c_str());
+        }
+    }
+    inNode->mFinishTime = FTimeStat::RealTimeClock();
+
+    for (SNode* dependent : inNode->mDependents) {
+        if (inNode->mFailed || inNode->mSkip)
+            dependent->mSkip = true;
+        if (--dependent->mPending == 0)
+            ScheduleOrSkip(dependent);
+    }
+
+    std::unique_lock<std::mutex> lk(mAccessControl);
+    if (--mRemaining == 0)
+        mCallerCondition.notify_one();
+}
+
+// Return the critical path, from the first node to the last finished one
+std::vector<const CTaskGraph::SNode*> CTaskGraph::GetCriticalPath() const {
+    std::vector<const SNode*> path;
+    const SNode* node = nullptr;
+    for (const std::unique_ptr<SNode>& candidate : mNodes) {
+        if (node == nullptr || candidate->mFinishTime > node->mFinishTime)
+            node = candidate.get();
+    }
+    // Walk back through the dependency that finished last (the one that allowed the node to start)
+    while (node != nullptr) {
+        path.insert(path.begin(), node);
+        const SNode* last = nullptr;
+        for (const SNode* dependency : node->mDependencies) {
+            if (last == nullptr || dependency->mFinishTime > last->mFinishTime)
+                last = dependency;
+        }
+        node = last;
+    }
+    return path;
+}
+
+// Print the nodes times and the critical path (the chain of nodes that determined the total time)
+void CTaskGraph::PrintReport(EP2DB inMsgLevel) const {
+    if (mNodes.empty() || mFinishTime == 0.0)
+        return;
+    Printf2DB(inMsgLevel, "Task graph %s real=%.3lfs\n", mName, mFinishTime - mStartTime);
+    for (const std::unique_ptr<SNode>& node : mNodes) {
+        Printf2DB(inMsgLevel, "\t%-28s start=%.3lfs, duration=%.3lfs%s\n", node->mName, node->mStartTime - mStartTime,
+                  node->mFinishTime - node->mStartTime, node->mFailed ? " (failed)" : node->mSkip ? " (skipped)" : "");
+    }
+    std::vector<const SNode*> path = GetCriticalPath();
+    utf8_string pathString;
+    for (const SNode* node : path)
+        pathString += Utf8StringFormat("%s%s(%.3lfs)", pathString.empty() ? "" : " -> ", node->mName, node->mFinishTime - node->mStartTime);
+    Printf2DB(inMsgLevel, "\tCritical path: %s\n", pathString.c_str());
+}
+
+} // namespace Vim2Ds
@@ -0,0 +1,72 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#pragma once
+
+#include "CTaskMgr.h"
+
+#include <functional>
+#include <initializer_list>
+
+namespace Vim2Ds {
+
+// Named tasks linked by dependencies, each task is run (on CTaskMgr) as soon as all it's dependencies are done.
+// Nodes failing (exception) cause their dependents to be skipped, Run rethrow after all other nodes are done.
+class CTaskGraph {
+  public:
+    typedef uint32_t NodeId;
+
+    // Where the node is run
+    enum ERunOn {
+        kRunOnWorker, // On a CTaskMgr thread
+        kRunOnCaller // On the thread calling Run (for nodes joining their own tasks)
+    };
+
+    // Constructor
+    CTaskGraph(const utf8_t* inName);
+
+    // Destructor
+    ~CTaskGraph();
+
+    // Add a node calling inWork() once all inDependencies are done (the lambda captures are stored in the node)
+    NodeId AddNode(const utf8_t* inName, ERunOn inRunOn, std::initializer_list<NodeId> inDependencies, std::function<void()> inWork);
+
+    // Add a dependency: inNode will start after inDependency is done
+    void AddDependency(NodeId inNode, NodeId inDependency);
+
+    // Run all nodes and wait until they are done (throw if a node failed)
+    void Run();
+
+    // Print the nodes times and the critical path (the chain of nodes that determined the total time)
+    void PrintReport(EP2DB inMsgLevel) const;
+
+  private:
+    struct SNode;
+
+    // The node can start (all dependencies done)
+    void Schedule(SNode* inNode);
+
+    // Schedule the node, or mark it failed if it can't be
+    void ScheduleOrSkip(SNode* inNode);
+
+    // Run the node work (unless skipped) and schedule the dependents that became ready
+    void Execute(SNode* inNode);
+
+    // Return the critical path, from the first node to the last finished one
+    std::vector<const SNode*> GetCriticalPath() const;
+
+    const utf8_t* const mName;
+    std::vector<std::unique_ptr<SNode>> mNodes;
+
+    // Run state
+    CTaskMgr::CTaskJointer* mJointer = nullptr;
+    std::mutex mAccessControl;
+    std::condition_variable mCallerCondition; // Signaled when a caller node is ready or all nodes are done
+    std::vector<SNode*> mCallerReady; // Nodes ready to be run by the caller thread
+    uint32_t mRemaining = 0; // Nodes not done yet
+    utf8_string mFirstError; // Error of the first failed node
+    double mStartTime = 0.0;
+    double mFinishTime = 0.0;
+};
+
+} // namespace Vim2Ds
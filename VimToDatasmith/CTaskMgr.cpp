@@ -2,32 +2,347 @@
 // Licensed under the MIT License 1.0
 
 #include "CTaskMgr.h"
+#include "CTaskStats.h"
+#include "SystemResources.h"
 
-#include <chrono>
 #include <stdexcept>
-using namespace std::literals;
 
 namespace Vim2Ds {
 
 static CTaskMgr* STaskMgr = nullptr;
 
-void CTaskMgr::RunITask(CTaskMgr* inMgr) {
+static CTaskMgr::SSettings STaskMgrSettings;
+
+// Chase-Lev work stealing deque: the owner push and pop at the bottom without lock, thieves steal at the top.
+// Top and bottom accesses are sequentially consistent, it's what the algorithm need to resolve the race for the last task.
+class CTaskMgr::CWorkDeque {
+  public:
+    // Constructor
+    CWorkDeque()
+    : mTop(0)
+    , mBottom(0) {
+        mArrays.emplace_back(new SArray(kInitialCapacity));
+        mArray = mArrays.back().get();
+    }
+
+    // Push a task at the bottom (owner only)
+    void Push(ITask* inTask) {
+        int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        int64_t top = mTop.load(std::memory_order_acquire);
+        SArray* array = mArray.load(std::memory_order_relaxed);
+        if (bottom - top >= int64_t(array->mCapacity))
+            array = Grow(array, top, bottom);
+        array->Put(bottom, inTask);
+        mBottom.store(bottom + 1, std::memory_order_seq_cst);
+    }
+
+    // Pop the last pushed task (owner only)
+    ITask* Pop() {
+        int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        SArray* array = mArray.load(std::memory_order_relaxed);
+        mBottom.store(bottom, std::memory_order_seq_cst);
+        int64_t top = mTop.load(std::memory_order_seq_cst);
+        ITask* task = nullptr;
+        if (top <= bottom) {
+            task = array->Get(bottom);
+            if (top == bottom) {
+                // Last task, race against thieves
+                if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    task = nullptr;
+                mBottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+        } else
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+        return task;
+    }
+
+    // Steal the oldest task (any thread)
+    ITask* Steal() {
+        int64_t top = mTop.load(std::memory_order_seq_cst);
+        int64_t bottom = mBottom.load(std::memory_order_seq_cst);
+        if (top >= bottom)
+            return nullptr;
+        SArray* array = mArray.load(std::memory_order_acquire);
+        ITask* task = array->Get(top);
+        if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr; // Lost the race, an other thread took it
+        return task;
+    }
+
+    // Approximative emptiness (any thread)
+    bool IsEmpty() const { return mTop.load(std::memory_order_seq_cst) >= mBottom.load(std::memory_order_seq_cst); }
+
+  private:
+    enum : size_t { kInitialCapacity = 1024 };
+
+    // Circular array of tasks (capacity is a power of 2)
+    struct SArray {
+        SArray(size_t inCapacity)
+        : mCapacity(inCapacity)
+        , mItems(new std::atomic<ITask*>[inCapacity]) {}
+
+        ITask* Get(int64_t inIndex) const { return mItems[size_t(inIndex) & (mCapacity - 1)].load(std::memory_order_relaxed); }
+        void Put(int64_t inIndex, ITask* inTask) { mItems[size_t(inIndex) & (mCapacity - 1)].store(inTask, std::memory_order_relaxed); }
+
+        const size_t mCapacity;
+        std::unique_ptr<std::atomic<ITask*>[]> mItems;
+    };
+
+    // Double the array capacity (owner only, previous arrays are kept since thieves may still read them)
+    SArray* Grow(SArray* inArray, int64_t inTop, int64_t inBottom) {
+        mArrays.emplace_back(new SArray(inArray->mCapacity * 2));
+        SArray* array = mArrays.back().get();
+        for (int64_t index = inTop; index < inBottom; ++index)
+            array->Put(index, inArray->Get(index));
+        mArray.store(array, std::memory_order_release);
+        return array;
+    }
+
+    std::atomic<int64_t> mTop;
+    std::atomic<int64_t> mBottom;
+    std::atomic<SArray*> mArray;
+    std::vector<std::unique_ptr<SArray>> mArrays; // All arrays allocated
+};
+
+// Worker thread and it's deque
+struct CTaskMgr::SWorker {
+    CTaskMgr* mMgr;
+    uint32_t mIndex;
+    uint32_t mRandom; // State of the victim selection generator (non workers threads use SStealRandom)
+    CWorkDeque mDeque;
+    std::unique_ptr<std::thread> mThread;
+};
+
+// Joinable tasks storage: fixed size blocks recycled by thread, so scheduling many small tasks doesn't hit the allocator.
+// Tasks are often deleted by an other thread than the one that created them, so threads exchange free blocks by
+// batches through a shared list.
+static const size_t kTaskBlockSize = 128;
+static const uint32_t kTaskBlocksByBatch = 128;
+
+// Free block, linked in the free lists
+struct STaskBlock {
+    STaskBlock* mNext;
+};
+
+// Batch of free blocks
+struct STaskBlocksBatch {
+    STaskBlock* mFirst;
+    uint32_t mCount;
+};
+
+// Free blocks shared by all threads
+class CSharedTaskBlocks {
+  public:
+    // Destructor
+    ~CSharedTaskBlocks() {
+        for (void* slab : mSlabs)
+            ::operator delete(slab);
+    }
+
+    // Take a batch of free blocks (allocate a new slab if none)
+    STaskBlocksBatch TakeBatch() {
+        std::lock_guard<std::mutex> lock(mAccessControl);
+        if (!mBatches.empty()) {
+            STaskBlocksBatch batch = mBatches.back();
+            mBatches.pop_back();
+            return batch;
+        }
+        char* slab = static_cast<char*>(::operator new(kTaskBlockSize * kTaskBlocksByBatch));
+        mSlabs.push_back(slab);
+        STaskBlock* first = nullptr;
+        for (uint32_t i = kTaskBlocksByBatch; i-- > 0;) {
+            STaskBlock* block = reinterpret_cast<STaskBlock*>(slab + i * kTaskBlockSize);
+            block->mNext = first;
+            first = block;
+        }
+        return {first, kTaskBlocksByBatch};
+    }
+
+    // Give back a batch of free blocks
+    void GiveBatch(const STaskBlocksBatch& inBatch) {
+        std::lock_guard<std::mutex> lock(mAccessControl);
+        mBatches.push_back(inBatch);
+    }
+
+    // The unique instance
+    static CSharedTaskBlocks& Get() {
+        static CSharedTaskBlocks SSharedTaskBlocks;
+        return SSharedTaskBlocks;
+    }
+
+  private:
+    std::mutex mAccessControl;
+    std::vector<STaskBlocksBatch> mBatches;
+    std::vector<void*> mSlabs;
+};
+
+// Free blocks of a thread
+class CThreadTaskBlocks {
+  public:
+    // Constructor
+    CThreadTaskBlocks()
+    : mShared(CSharedTaskBlocks::Get()) {}
+
+    // Destructor, give back the blocks
+    ~CThreadTaskBlocks() {
+        if (mFree.mCount != 0)
+            mShared.GiveBatch(mFree);
+    }
+
+    // Take a free block
+    void* Allocate() {
+        if (mFree.mCount == 0)
+            mFree = mShared.TakeBatch();
+        STaskBlock* block = mFree.mFirst;
+        mFree.mFirst = block->mNext;
+        --mFree.mCount;
+        return block;
+    }
+
+    // Recycle the block, give a batch back when we keep too many
+    void Free(void* inBlock) {
+        STaskBlock* block = static_cast<STaskBlock*>(inBlock);
+        block->mNext = mFree.mFirst;
+        mFree.mFirst = block;
+        if (++mFree.mCount >= 2 * kTaskBlocksByBatch) {
+            STaskBlock* last = mFree.mFirst;
+            for (uint32_t i = 1; i < kTaskBlocksByBatch; ++i)
+                last = last->mNext;
+            STaskBlocksBatch batch = {mFree.mFirst, kTaskBlocksByBatch};
+            mFree.mFirst = last->mNext;
+            mFree.mCount -= kTaskBlocksByBatch;
+            mShared.GiveBatch(batch);
+        }
+    }
+
+  private:
+    // Constructed before the thread's cache, so it's destroyed after it
+    CSharedTaskBlocks& mShared;
+    STaskBlocksBatch mFree = {nullptr, 0};
+};
+
+static thread_local CThreadTaskBlocks SThreadTaskBlocks;
+
+// Allocate the task storage
+void* CTaskMgr::CJoinableTask::operator new(size_t inSize) {
+    if (inSize > kTaskBlockSize)
+        return ::operator new(inSize);
+    return SThreadTaskBlocks.Allocate();
+}
+
+// Recycle the task storage
+void CTaskMgr::CJoinableTask::operator delete(void* inTask, size_t inSize) {
+    if (inSize > kTaskBlockSize)
+        ::operator delete(inTask);
+    else if (inTask != nullptr)
+        SThreadTaskBlocks.Free(inTask);
+}
+
+// Worker of the current thread (nullptr for non worker threads)
+thread_local CTaskMgr::SWorker* CTaskMgr::SCurrentWorker = nullptr;
+
+// Victim selection generator state of non worker threads
+static thread_local uint32_t SStealRandom = 0x2545F491u;
+
+// True for the I/O threads
+static thread_local bool SIsIOThread = false;
+
+// Managers are numbered, so a thread's statistics can't be taken for those of a new manager at the same address
+static std::atomic<uint32_t> STaskMgrGeneration(0);
+
+// Statistics of the current thread, and the generation of the manager they belong to
+static thread_local CTaskStats* SCurrentStats = nullptr;
+static thread_local uint32_t SCurrentStatsGeneration = 0;
+
+// I/O threads count, file writes don't scale with the cores
+static const unsigned kIOThreadsCount = 2;
+
+void CTaskMgr::RunITask(CTaskMgr* inMgr, SWorker* inWorker) {
     AutoReleasePool {
 #if macOS
         pthread_setname_np("CTaskMgr::RunITask");
 #endif
-        ITask* myATask = inMgr->GetTask();
+        SCurrentWorker = inWorker;
+        if (inMgr->mSettings.mPinWorkers && !PinCurrentThread(inWorker->mIndex))
+            DebugF("CTaskMgr::RunITask - Can't pin worker %u\n", inWorker->mIndex);
+        ITask* myATask = inMgr->GetTask(inWorker);
         while (myATask) {
-            try {
-                myATask->Run();
-            } catch (std::exception& e) {
-                DebugF("CTaskMgr::RunITask - Catch std exception %s\n", e.what());
-            } catch (...) {
-                DebugF("CTaskMgr::RunITask - Catch unknown exception\n");
-            }
-            myATask = inMgr->GetTask();
+            inMgr->RunTask(myATask);
+            myATask = inMgr->GetTask(inWorker);
         }
+        SCurrentWorker = nullptr;
+    }
+}
+
+// I/O thread loop
+void CTaskMgr::RunIOTasks(CTaskMgr* inMgr) {
+    AutoReleasePool {
+#if macOS
+        pthread_setname_np("CTaskMgr::RunIOTasks");
+#endif
+        SIsIOThread = true;
+        ITask* myATask = inMgr->GetIOTask();
+        while (myATask) {
+            inMgr->RunTask(myATask);
+            myATask = inMgr->GetIOTask();
+        }
+    }
+}
+
+// Run the task and account it's completion
+void CTaskMgr::RunTask(ITask* inTask) {
+    // Task is deleted by Run, so get what we need before
+    CTaskStats* stats = GetCurrentStats();
+    const utf8_t* typeName = inTask->GetTypeName();
+    int64_t startTime = CTaskStats::Now();
+    int64_t waitTime = startTime - inTask->mAddedTime;
+    bool gotException = true;
+    stats->BeginTask();
+    try {
+        inTask->Run();
+        gotException = false;
+    } catch (std::exception& e) {
+        DebugF("CTaskMgr::RunTask - Catch std exception %s\n", e.what());
+    } catch (...) {
+        DebugF("CTaskMgr::RunTask - Catch unknown exception\n");
+    }
+    stats->EndTask(typeName, waitTime, CTaskStats::Now() - startTime, gotException);
+    TaskDone();
+}
+
+// Return the statistics of the current thread (created on first use)
+CTaskStats* CTaskMgr::GetCurrentStats() {
+    if (SCurrentStatsGeneration != mGeneration) {
+        std::lock_guard<std::mutex> lock(mStatsAccessControl);
+        utf8_string threadName;
+        SWorker* worker = GetCurrentWorker();
+        if (worker != nullptr)
+            threadName = Utf8StringFormat("Worker %u", worker->mIndex);
+        else
+            threadName = Utf8StringFormat("%s %u", SIsIOThread ? "I/O" : "Thread", unsigned(mStats.size()));
+        mStats.emplace_back(new CTaskStats(threadName, SIsIOThread));
+        SCurrentStats = mStats.back().get();
+        SCurrentStatsGeneration = mGeneration;
     }
+    return SCurrentStats;
+}
+
+// Print the tasks statistics by type (jointer name) and the threads busy and idle times
+void CTaskMgr::PrintStats(EP2DB inMsgLevel) {
+    std::lock_guard<std::mutex> lock(mStatsAccessControl);
+    CTaskStats::Print(mStats, CTaskStats::Now() - mStartTime, inMsgLevel);
+}
+
+// Return the worker of the current thread if it's one of ours
+CTaskMgr::SWorker* CTaskMgr::GetCurrentWorker() const {
+    SWorker* worker = SCurrentWorker;
+    return worker != nullptr && worker->mMgr == this ? worker : nullptr;
+}
+
+// Set the settings of the task manager, must be called before it's creation (first Get)
+void CTaskMgr::SetSettings(const SSettings& inSettings) {
+    TestAssert(STaskMgr == nullptr);
+    STaskMgrSettings = inSettings;
 }
 
 CTaskMgr& CTaskMgr::Get() {
@@ -39,60 +354,76 @@ CTaskMgr& CTaskMgr::Get() {
 
 void CTaskMgr::DeleteMgr() {
     if (STaskMgr) {
-        CTaskMgr* Tmp = STaskMgr;
+        // Workers still use Get while finishing their tasks, so clear STaskMgr only after they are stopped
+        delete STaskMgr;
         STaskMgr = nullptr;
-        delete Tmp;
     }
 }
 
 // Constructor
 CTaskMgr::CTaskMgr()
-: mThreadingEnabled(true) {
+: mHighPriorityCount(0)
+, mSettings(STaskMgrSettings)
+, mSleepingCount(0)
+, mPendingCount(0)
+, mWaitingJoinersCount(0)
+, mTerminate(false)
+, mThreadingEnabled(true)
+, mGeneration(++STaskMgrGeneration)
+, mStartTime(CTaskStats::Now()) {
     if (mThreadingEnabled) {
-        // One thread by processor
-        mNbProcessors = std::thread::hardware_concurrency();
-        if (mNbProcessors == 0) {
-            mNbProcessors = 1;
+        // One thread by processor we may use (in containers, less than the host's processors)
+        mNbProcessors = mSettings.mWorkersCount != 0 ? mSettings.mWorkersCount : GetAvailableProcessors();
+        mWorkers.resize(mNbProcessors);
+        for (unsigned i = 0; i < mNbProcessors; i++) {
+            mWorkers[i].reset(new SWorker());
+            mWorkers[i]->mMgr = this;
+            mWorkers[i]->mIndex = i;
+            mWorkers[i]->mRandom = 0x9E3779B9u * (i + 1);
         }
-        mTreads.resize(mNbProcessors);
-        mNbRunning = mNbProcessors;
+        // Started once all workers exist, since they steal from each others
         for (unsigned i = 0; i < mNbProcessors; i++) {
-            mTreads[i].reset(new std::thread(RunITask, this));
+            mWorkers[i]->mThread.reset(new std::thread(RunITask, this, mWorkers[i].get()));
         }
+        mIOThreads.resize(kIOThreadsCount);
+        for (std::unique_ptr<std::thread>& ioThread : mIOThreads)
+            ioThread.reset(new std::thread(RunIOTasks, this));
     }
 }
 
 // Destructor
 CTaskMgr::~CTaskMgr() {
+    Join();
     {
         std::lock_guard<std::mutex> lock(mAccessControl);
         mTerminate = true;
     }
-    Join();
-
-    mThreadControlConditionVariable.notify_all();
-    size_t nbThreads = mTreads.size();
-    for (size_t i = 0; i < nbThreads; i++) {
-        mTreads[i]->join();
+    mWorkerCondition.notify_all();
+    for (std::unique_ptr<SWorker>& worker : mWorkers) {
+        worker->mThread->join();
     }
-
-    // Empty the task
-    while (!mTaskQueue.empty())
-        mTaskQueue.pop();
+    { std::lock_guard<std::mutex> lock(mIOAccessControl); }
+    mIOTaskCondition.notify_all();
+    for (std::unique_ptr<std::thread>& ioThread : mIOThreads)
+        ioThread->join();
 }
 
 // Add task
-void CTaskMgr::AddTask(ITask* inTask) {
+void CTaskMgr::AddTask(ITask* inTask, EPriority inPriority) {
     if (mThreadingEnabled) {
-        // Add the task to the queue
-        {
-            std::unique_lock<std::mutex> lk(mAccessControl);
-            if (mTerminate)
-                throw std::runtime_error("Adding task to a terminated CTaskMgr");
-            mTaskQueue.push(inTask);
-        }
-        mThreadControlConditionVariable.notify_all();
+        if (mTerminate)
+            throw std::runtime_error("Adding task to a terminated CTaskMgr");
+        ++mPendingCount;
+        inTask->mAddedTime = CTaskStats::Now();
+        SWorker* worker = GetCurrentWorker();
+        if (worker != nullptr && inPriority == kPriorityNormal) {
+            // From a worker: on it's own deque, without lock
+            worker->mDeque.Push(inTask);
+            WakeWorker();
+        } else
+            QueueTask(inTask, inPriority);
     } else {
+        ++mPendingCount;
         try {
             inTask->Run();
         } catch (std::exception& e) {
@@ -100,76 +431,237 @@ void CTaskMgr::AddTask(ITask* inTask) {
         } catch (...) {
             DebugF("CTaskMgr::AddTask - Catch unknown exception\n");
         }
+        TaskDone();
     }
 }
 
-// Wait until all task have been processed
-void CTaskMgr::Join() {
-    bool hasWorks = false;
-    std::unique_lock<std::mutex> lk(mAccessControl);
-    if (mNbRunning != 0 || !mTaskQueue.empty()) {
-        TraceF("CTaskMgr::Join - Wait for %ld task to be processed ", mTaskQueue.size());
-        hasWorks = true;
-    }
-    clock_t previous = clock();
-    while (mNbRunning != 0 || (!mTaskQueue.empty() && !mTerminate)) {
-        clock_t current = clock();
-        if (current - previous > CLOCKS_PER_SEC) {
-            previous = current;
-            TraceF(".");
-        }
-        lk.unlock();
-        mThreadControlConditionVariable.notify_one();
-        std::this_thread::sleep_for(1ms);
-        lk.lock();
+// Queue the task in the shared queues and wake a worker or a joiner
+void CTaskMgr::QueueTask(ITask* inTask, EPriority inPriority) {
+    {
+        std::unique_lock<std::mutex> lk(mAccessControl);
+        if (inPriority == kPriorityHigh) {
+            mHighPriorityQueue.push_back(inTask);
+            ++mHighPriorityCount;
+        } else
+            mTaskQueue.push_back(inTask);
+        if (mSleepingCount != 0)
+            mWorkerCondition.notify_one();
     }
-    if (hasWorks)
-        TraceF("\nCTaskMgr::Join - Done\n");
+    // Waiting joiners can help
+    if (mWaitingJoinersCount != 0)
+        NotifyJoiners();
 }
 
-// Get the next task to be run
-CTaskMgr::ITask* CTaskMgr::GetTask() {
+// Add a blocking I/O task, run by the I/O threads (wait while too many I/O tasks are queued)
+void CTaskMgr::AddIOTask(ITask* inTask) {
+    if (!mThreadingEnabled) {
+        AddTask(inTask);
+        return;
+    }
+    if (mTerminate)
+        throw std::runtime_error("Adding I/O task to a terminated CTaskMgr");
+    ++mPendingCount;
+    {
+        std::unique_lock<std::mutex> lk(mIOAccessControl);
+        // Producers wait for the disk instead of queuing more data in memory (I/O threads don't wait for themselves)
+        if (!SIsIOThread)
+            mIOSpaceCondition.wait(lk, [this] { return mIOQueue.size() < mSettings.mMaxQueuedIOTasks; });
+        inTask->mAddedTime = CTaskStats::Now();
+        mIOQueue.push_back(inTask);
+    }
+    mIOTaskCondition.notify_one();
+}
+
+// Get the next I/O task (wait for one, return nullptr when terminated)
+CTaskMgr::ITask* CTaskMgr::GetIOTask() {
     ITask* task = nullptr;
+    {
+        std::unique_lock<std::mutex> lk(mIOAccessControl);
+        if (mIOQueue.empty() && !mTerminate) {
+            int64_t sleepStart = CTaskStats::Now();
+            mIOTaskCondition.wait(lk, [this] { return !mIOQueue.empty() || mTerminate; });
+            GetCurrentStats()->AddSleep(CTaskStats::Now() - sleepStart);
+        }
+        if (mIOQueue.empty())
+            return nullptr;
+        task = mIOQueue.front();
+        mIOQueue.pop_front();
+    }
+    mIOSpaceCondition.notify_one();
+    return task;
+}
 
-    // Try to get the front task
-    std::unique_lock<std::mutex> lk(mAccessControl);
-    --mNbRunning;
-    if (!mTerminate) {
-        if (!mTaskQueue.empty()) {
-            task = mTaskQueue.front();
-            mTaskQueue.pop();
+// A task has been pushed, wake up a sleeping worker (if any)
+void CTaskMgr::WakeWorker() {
+    // Sequentially consistent with the sleeping worker increment followed by it's check of the deques
+    if (mSleepingCount != 0) {
+        std::lock_guard<std::mutex> lock(mAccessControl);
+        mWorkerCondition.notify_one();
+    } else if (mWaitingJoinersCount != 0)
+        NotifyJoiners(); // No sleeping worker, but a joiner can help
+}
+
+// A task is done
+void CTaskMgr::TaskDone() {
+    if (--mPendingCount == 0)
+        NotifyJoiners();
+}
+
+// Wake up the threads waiting in Join
+void CTaskMgr::NotifyJoiners() {
+    // Lock, so a joiner can't miss the notification between it's check and it's wait
+    { std::lock_guard<std::mutex> lock(mJoinAccessControl); }
+    mJoinCondition.notify_all();
+}
+
+// Run tasks until inIsDone return true, block when there's no task to run
+template <class Predicate> void CTaskMgr::HelpUntil(const Predicate& inIsDone) {
+    SWorker* worker = GetCurrentWorker();
+    while (!inIsDone()) {
+        // Help: run queued tasks while waiting, so nested joins don't starve the workers
+        ITask* task = FindTask(worker);
+        if (task != nullptr) {
+            RunTask(task);
+            continue;
         }
 
-        if (task == nullptr) {
-            // No task, wait for added one
-            mThreadControlConditionVariable.wait(lk, [this, &task] {
-                if (!mTaskQueue.empty()) {
-                    task = mTaskQueue.front();
-                    mTaskQueue.pop();
-                }
-                return task != nullptr || mTerminate;
-            });
+        std::unique_lock<std::mutex> lk(mJoinAccessControl);
+        ++mWaitingJoinersCount;
+        // Check after the increment: tasks done or added after it will notify us
+        bool hasQueuedTasks;
+        {
+            std::lock_guard<std::mutex> lock(mAccessControl);
+            hasQueuedTasks = HasQueuedTasks();
+        }
+        if (!hasQueuedTasks && !inIsDone()) {
+            int64_t sleepStart = CTaskStats::Now();
+            mJoinCondition.wait(lk);
+            GetCurrentStats()->AddSleep(CTaskStats::Now() - sleepStart);
         }
+        --mWaitingJoinersCount;
+    }
+}
 
-        if (task != nullptr)
-            ++mNbRunning;
+// Wait until all task have been processed (the calling thread run queued tasks while waiting)
+void CTaskMgr::Join() {
+    if (mPendingCount != 0) {
+        TraceF("CTaskMgr::Join - Wait for %u task to be processed\n", uint32_t(mPendingCount));
+        HelpUntil([this] { return mPendingCount == 0; });
+        TraceF("CTaskMgr::Join - Done\n");
     }
+}
 
+// Find a task for the current thread (inWorker may be nullptr), return nullptr if none
+CTaskMgr::ITask* CTaskMgr::FindTask(SWorker* inWorker) {
+    ITask* task = TakeHighPriorityTask();
+    if (task == nullptr && inWorker != nullptr)
+        task = inWorker->mDeque.Pop();
+    if (task == nullptr)
+        task = TakeQueuedTasks(inWorker);
+    if (task == nullptr)
+        task = StealTask(inWorker);
     return task;
 }
 
-// Join all task before continuing
-void CTaskMgr::CTaskJointer::Join(bool inRethrow) {
-    if (mTaskCount != 0) {
-        CTaskMgr& mgr = CTaskMgr::Get();
-        std::unique_lock<std::mutex> lk(mgr.mAccessControl);
-        while (mTaskCount != 0) {
-            lk.unlock();
-            mgr.mThreadControlConditionVariable.notify_one();
-            std::this_thread::sleep_for(1ms);
-            lk.lock();
+// Take the oldest high priority task, return nullptr if none
+CTaskMgr::ITask* CTaskMgr::TakeHighPriorityTask() {
+    if (mHighPriorityCount == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(mAccessControl);
+    if (mHighPriorityQueue.empty())
+        return nullptr;
+    ITask* task = mHighPriorityQueue.front();
+    mHighPriorityQueue.pop_front();
+    --mHighPriorityCount;
+    return task;
+}
+
+// Take a batch of tasks from the shared queue, return the first one (the others are pushed on the worker's deque)
+CTaskMgr::ITask* CTaskMgr::TakeQueuedTasks(SWorker* inWorker) {
+    std::unique_lock<std::mutex> lk(mAccessControl);
+    if (mTaskQueue.empty())
+        return nullptr;
+
+    // Take our share, the other workers will steal from us if we took too much (non workers take only one)
+    size_t count = 1;
+    if (inWorker != nullptr)
+        count = std::min(std::min(mTaskQueue.size() / mWorkers.size() + 1, mTaskQueue.size()), size_t(32));
+    ITask* task = mTaskQueue.front();
+    mTaskQueue.pop_front();
+    for (size_t i = 1; i < count; ++i) {
+        inWorker->mDeque.Push(mTaskQueue.front());
+        mTaskQueue.pop_front();
+    }
+    bool wakeOther = count > 1 || !mTaskQueue.empty();
+    lk.unlock();
+
+    if (wakeOther)
+        WakeWorker();
+    return task;
+}
+
+// Try to steal a task from a worker
+CTaskMgr::ITask* CTaskMgr::StealTask(SWorker* inWorker) {
+    size_t workersCount = mWorkers.size();
+    if (workersCount == 0 || (workersCount == 1 && inWorker != nullptr))
+        return nullptr;
+
+    // Start from a random victim, so thieves spread over the workers
+    uint32_t& random = inWorker != nullptr ? inWorker->mRandom : SStealRandom;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    size_t start = random % workersCount;
+    for (size_t i = 0; i < workersCount; ++i) {
+        SWorker* victim = mWorkers[(start + i) % workersCount].get();
+        if (victim != inWorker) {
+            ITask* task = victim->mDeque.Steal();
+            if (task != nullptr) {
+                GetCurrentStats()->AddSteal();
+                return task;
+            }
         }
     }
+    return nullptr;
+}
+
+// Is there any task waiting (mAccessControl must be locked)
+bool CTaskMgr::HasQueuedTasks() const {
+    if (!mTaskQueue.empty() || !mHighPriorityQueue.empty())
+        return true;
+    for (const std::unique_ptr<SWorker>& worker : mWorkers) {
+        if (!worker->mDeque.IsEmpty())
+            return true;
+    }
+    return false;
+}
+
+// Get the next task to be run by this worker (wait for one, return nullptr when terminated)
+CTaskMgr::ITask* CTaskMgr::GetTask(SWorker* inWorker) {
+    for (;;) {
+        ITask* task = FindTask(inWorker);
+        if (task != nullptr)
+            return task;
+
+        // No task, wait for added one
+        std::unique_lock<std::mutex> lk(mAccessControl);
+        if (mTerminate)
+            return nullptr;
+        ++mSleepingCount;
+        // Check after the increment: a task pushed before it has been seen, one pushed after it will wake us
+        if (!HasQueuedTasks()) {
+            int64_t sleepStart = CTaskStats::Now();
+            mWorkerCondition.wait(lk);
+            GetCurrentStats()->AddSleep(CTaskStats::Now() - sleepStart);
+        }
+        --mSleepingCount;
+    }
+}
+
+// Join all task before continuing
+void CTaskMgr::CTaskJointer::Join(bool inRethrow) {
+    if (mTaskCount != 0)
+        CTaskMgr::Get().HelpUntil([this] { return mTaskCount == 0; });
     if (inRethrow && mGotExceptionCount != 0) {
         uint32_t gotExceptionCount = mGotExceptionCount;
         mGotExceptionCount = 0;
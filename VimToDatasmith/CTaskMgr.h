@@ -6,23 +6,46 @@
 #include "DebugTools.h"
 #include "VimToDatasmith.h"
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 
 namespace Vim2Ds {
 
+class CTaskStats;
+
+// Tasks are run by one worker thread by processor. Each worker has it's own deque: tasks added by a worker are pushed
+// on it's deque (without lock) and idle workers steal from the others. Tasks added by other threads are queued in a
+// shared queue the workers take from by batch. High priority tasks have their own shared queue, checked first.
+// Blocking I/O tasks are run by a few dedicated threads, so they don't stall the workers.
 class CTaskMgr {
   public:
+    // Priority of CPU tasks
+    enum EPriority {
+        kPriorityNormal,
+        kPriorityHigh // Taken before the normal ones (pipeline stages other tasks depend on)
+    };
+
     // Task class, your class must inherit from this class.
     class ITask {
       public:
         virtual void Run() = 0;
 
+        // Type of the task (for the statistics)
+        virtual const utf8_t* GetTypeName() const { return "ITask"; }
+
       protected:
         virtual ~ITask(){};
+
+      private:
+        friend class CTaskMgr;
+        int64_t mAddedTime = 0; // When the task has been added (for the statistics)
     };
 
     // Lightweight task synchronization mechanism
@@ -35,18 +58,38 @@ class CTaskMgr {
         virtual ~CJoinableTask();
 
         // Start the task
-        void Start(CTaskJointer* inTaskJointer);
+        void Start(CTaskJointer* inTaskJointer, EPriority inPriority = kPriorityNormal);
+
+        // Start the task on an I/O thread
+        void StartIO(CTaskJointer* inTaskJointer);
 
         virtual void Run() override;
 
         virtual void RunTask() = 0;
 
+        // Type of the task, it's jointer name
+        virtual const utf8_t* GetTypeName() const override;
+
+        // Task storage is taken from blocks recycled by thread (large tasks use the heap)
+        static void* operator new(size_t inSize);
+        static void operator delete(void* inTask, size_t inSize);
+
       private:
         CTaskJointer* mTaskJointer = nullptr;
     };
 
-    // Lightweight joinable functor task
-    template <class Parameter> class TJoinableFunctorTask;
+    // Lightweight joinable task running a callable object (lambda with captures)
+    template <class Functor> class TJoinableCallableTask;
+
+    // Task manager settings
+    struct SSettings {
+        unsigned mWorkersCount = 0; // 0: one by available processor
+        size_t mMaxQueuedIOTasks = 16; // I/O tasks queued before producers wait
+        bool mPinWorkers = false; // Pin each worker on it's own processor
+    };
+
+    // Set the settings of the task manager, must be called before it's creation (first Get)
+    static void SetSettings(const SSettings& inSettings);
 
     // Constructor
     CTaskMgr();
@@ -56,49 +99,170 @@ class CTaskMgr {
 
     unsigned GetNbProcessors() const { return mNbProcessors; }
 
-    // Add task (if inRunNow, the task is run immediatly in current thread)
-    void AddTask(ITask* InTask);
+    // Add task
+    void AddTask(ITask* InTask, EPriority inPriority = kPriorityNormal);
+
+    // Add a blocking I/O task, run by the I/O threads (wait while too many I/O tasks are queued)
+    void AddIOTask(ITask* inTask);
 
     template <class Task> void AddTasks(std::vector<Task>& inTasks) {
         for (Task& task : inTasks)
             AddTask(&task);
     }
 
-    // Wait until all task have been processed
+    // Wait until all task have been processed (the calling thread run queued tasks while waiting)
     void Join();
 
+    // Print the tasks statistics by type (jointer name) and the threads busy and idle times
+    void PrintStats(EP2DB inMsgLevel);
+
+    // Call inFunctor(begin, end) on sub ranges of [inBegin, inEnd[ in parallel (the calling thread take part).
+    // The range is split in halves until sub ranges have at most inGrain items (0: about 8 sub ranges by processor),
+    // so the sub ranges only depend on the range and the grain, not on the scheduling.
+    template <class Index, class Functor> void ParallelFor(Index inBegin, Index inEnd, size_t inGrain, const Functor& inFunctor);
+
+    // Return the reduction by inReduce(left, right) of inMap(begin, end) results of the sub ranges (split as ParallelFor).
+    // Results are reduced in a fixed order, so the result is reproducible even for non associative operations.
+    // An empty range return inMap(inBegin, inBegin). Value must be default constructible and move assignable.
+    // An exception thrown by inMap or inReduce is rethrown as is.
+    template <class Value, class Index, class Map, class Reduce>
+    Value ParallelReduce(Index inBegin, Index inEnd, size_t inGrain, const Map& inMap, const Reduce& inReduce);
+
     static CTaskMgr& Get();
 
     static void DeleteMgr();
 
-    // Control access on this object (for queue operations)
-    std::mutex mAccessControl;
+  private:
+    class CWorkDeque;
+    struct SWorker;
 
-    // Control queue management
-    std::condition_variable mThreadControlConditionVariable;
+    static void RunITask(CTaskMgr* inMgr, SWorker* inWorker);
 
-  private:
-    static void RunITask(CTaskMgr* inMgr);
+    // I/O thread loop
+    static void RunIOTasks(CTaskMgr* inMgr);
+
+    // Queue the task in the shared queues and wake a worker or a joiner
+    void QueueTask(ITask* inTask, EPriority inPriority);
+
+    // Get the next I/O task (wait for one, return nullptr when terminated)
+    ITask* GetIOTask();
 
-    // Get the next task to be run
-    ITask* GetTask();
+    // Run the task and account it's completion
+    void RunTask(ITask* inTask);
 
-    // Threads used (≈ nomber of cpu)
-    std::vector<std::unique_ptr<std::thread>> mTreads;
+    // Return the statistics of the current thread (created on first use)
+    CTaskStats* GetCurrentStats();
 
-    // Fifo tasks queue
-    std::queue<ITask*> mTaskQueue;
+    // Return the worker of the current thread if it's one of ours
+    SWorker* GetCurrentWorker() const;
+
+    // Get the next task to be run by this worker (wait for one, return nullptr when terminated)
+    ITask* GetTask(SWorker* inWorker);
+
+    // Find a task for the current thread (inWorker may be nullptr), return nullptr if none
+    ITask* FindTask(SWorker* inWorker);
+
+    // Take the oldest high priority task, return nullptr if none
+    ITask* TakeHighPriorityTask();
+
+    // Take a batch of tasks from the shared queue, return the first one (the others are pushed on the worker's deque)
+    ITask* TakeQueuedTasks(SWorker* inWorker);
+
+    // Try to steal a task from a worker
+    ITask* StealTask(SWorker* inWorker);
+
+    // Run tasks until inIsDone return true, block when there's no task to run
+    template <class Predicate> void HelpUntil(const Predicate& inIsDone);
+
+    // Reduce the range, the right half being computed by an other task
+    template <class Value, class Index, class Map, class Reduce>
+    Value ReduceRange(size_t inBegin, size_t inEnd, size_t inGrain, const Map& inMap, const Reduce& inReduce);
+
+    // Is there any task waiting (mAccessControl must be locked)
+    bool HasQueuedTasks() const;
+
+    // A task has been pushed, wake up a sleeping worker (if any)
+    void WakeWorker();
+
+    // A task is done
+    void TaskDone();
+
+    // Wake up the threads waiting in Join
+    void NotifyJoiners();
+
+    // Worker of the current thread (nullptr for non worker threads)
+    static thread_local SWorker* SCurrentWorker;
+
+    // Workers (one by processor)
+    std::vector<std::unique_ptr<SWorker>> mWorkers;
 
     unsigned mNbProcessors = 1;
 
-    // Number of thread currently running
-    volatile unsigned mNbRunning = 0;
+    // Control access to the shared queue and the workers sleep
+    std::mutex mAccessControl;
+
+    // Workers without task wait on this
+    std::condition_variable mWorkerCondition;
+
+    // Fifo of tasks added by non worker threads
+    std::deque<ITask*> mTaskQueue;
+
+    // Fifo of high priority tasks
+    std::deque<ITask*> mHighPriorityQueue;
+
+    // Number of tasks in mHighPriorityQueue (checked without lock)
+    std::atomic<uint32_t> mHighPriorityCount;
+
+    // Settings used to create the task manager
+    const SSettings mSettings;
+
+    // I/O threads (few, to limit the disk queue depth)
+    std::vector<std::unique_ptr<std::thread>> mIOThreads;
 
-    // Destructor have been called, dont execute task anymore
-    volatile bool mTerminate = false;
+    // Control access to the I/O queue
+    std::mutex mIOAccessControl;
+
+    // I/O threads wait on this for a task (or the termination)
+    std::condition_variable mIOTaskCondition;
+
+    // Threads adding I/O tasks wait on this while the I/O queue is full
+    std::condition_variable mIOSpaceCondition;
+
+    // Fifo of I/O tasks
+    std::deque<ITask*> mIOQueue;
+
+    // Number of workers waiting on mWorkerCondition
+    std::atomic<uint32_t> mSleepingCount;
+
+    // Number of tasks added and not finished
+    std::atomic<uint32_t> mPendingCount;
+
+    // Control access for the join waits
+    std::mutex mJoinAccessControl;
+
+    // Signaled when all tasks or all tasks of a jointer are done, or when a task is added while joiners wait
+    std::condition_variable mJoinCondition;
+
+    // Number of joiners waiting on mJoinCondition
+    std::atomic<uint32_t> mWaitingJoinersCount;
+
+    // Destructor have been called, dont accept task anymore
+    std::atomic<bool> mTerminate;
 
     // False: tasks to run in main threads, true: Task run in thread
     bool mThreadingEnabled;
+
+    // Control access to mStats
+    std::mutex mStatsAccessControl;
+
+    // Statistics of each thread that ran tasks
+    std::vector<std::unique_ptr<CTaskStats>> mStats;
+
+    // Number of this manager (for the statistics)
+    const uint32_t mGeneration;
+
+    // Creation time (for the statistics)
+    int64_t mStartTime;
 };
 
 // Lightweight task synchronization mechanism
@@ -118,21 +282,33 @@ class CTaskMgr::CTaskJointer {
     }
 
     // A task is added
-    void AddTask(CJoinableTask* inTask) {
+    void AddTask(CJoinableTask* inTask, EPriority inPriority) {
+        ++mTaskCount;
+        CTaskMgr::Get().AddTask(inTask, inPriority);
+    }
+
+    // An I/O task is added
+    void AddIOTask(CJoinableTask* inTask) {
         ++mTaskCount;
-        CTaskMgr::Get().AddTask(inTask);
+        CTaskMgr::Get().AddIOTask(inTask);
     }
 
-    // Join all task before continuing
+    // Start a task calling inFunctor() (the lambda captures are stored in the task)
+    template <class Functor> void StartTask(const Functor& inFunctor, EPriority inPriority = kPriorityNormal);
+
+    // Start an I/O task calling inFunctor()
+    template <class Functor> void StartIOTask(const Functor& inFunctor);
+
+    // Join all task before continuing (the calling thread run queued tasks while waiting)
     void Join(bool inRethrow = true);
 
-    // A task finish it work
+    // A task finish it work (the jointer may be deleted as soon as the count reach 0)
     void RemoveTask(bool inGotException) {
         TestAssert(mTaskCount != 0);
-        if (--mTaskCount == 0)
-            CTaskMgr::Get().mThreadControlConditionVariable.notify_one();
         if (inGotException)
             ++mGotExceptionCount;
+        if (--mTaskCount == 0)
+            CTaskMgr::Get().NotifyJoiners();
     }
 
     // How many tasks finish because of an exception?
@@ -163,10 +339,22 @@ inline CTaskMgr::CJoinableTask::~CJoinableTask() {
 }
 
 // Start the task
-inline void CTaskMgr::CJoinableTask::Start(CTaskMgr::CTaskJointer* inTaskJointer) {
+inline void CTaskMgr::CJoinableTask::Start(CTaskMgr::CTaskJointer* inTaskJointer, EPriority inPriority) {
     TestAssert(mTaskJointer == nullptr && inTaskJointer != nullptr);
     mTaskJointer = inTaskJointer;
-    mTaskJointer->AddTask(this);
+    mTaskJointer->AddTask(this, inPriority);
+}
+
+// Type of the task, it's jointer name
+inline const utf8_t* CTaskMgr::CJoinableTask::GetTypeName() const {
+    return mTaskJointer != nullptr ? mTaskJointer->GetName() : "CJoinableTask";
+}
+
+// Start the task on an I/O thread
+inline void CTaskMgr::CJoinableTask::StartIO(CTaskMgr::CTaskJointer* inTaskJointer) {
+    TestAssert(mTaskJointer == nullptr && inTaskJointer != nullptr);
+    mTaskJointer = inTaskJointer;
+    mTaskJointer->AddIOTask(this);
 }
 
 // Execute the task
@@ -189,28 +377,76 @@ inline void CTaskMgr::CJoinableTask::Run() {
     }
 }
 
-// Lightweight joinable functor task (permit to call a lambda with parameter on a thread)
-template <class Parameter> class CTaskMgr::TJoinableFunctorTask : public CTaskMgr::CJoinableTask {
+// Lightweight joinable task running a callable object (lambda with captures)
+template <class Functor> class CTaskMgr::TJoinableCallableTask : public CTaskMgr::CJoinableTask {
   public:
-    // Function type
-    typedef void (*const Functor)(Parameter inParameter);
-
     // Constructor
-    TJoinableFunctorTask(Functor inFunctor, const Parameter& inParameter)
-    : mFunctor(inFunctor)
-    , mParameter(inParameter) {
-        TestAssert(mFunctor);
-    }
+    TJoinableCallableTask(const Functor& inFunctor)
+    : mFunctor(inFunctor) {}
 
     // Execute the functor
-    virtual void RunTask() override { mFunctor(mParameter); }
+    virtual void RunTask() override { mFunctor(); }
 
   protected:
-    // The functor
+    // The callable object
     Functor mFunctor;
-
-    // The functor parameters
-    Parameter mParameter;
 };
 
+// Start a task calling inFunctor()
+template <class Functor> void CTaskMgr::CTaskJointer::StartTask(const Functor& inFunctor, EPriority inPriority) {
+    (new TJoinableCallableTask<Functor>(inFunctor))->Start(this, inPriority);
+}
+
+// Start an I/O task calling inFunctor()
+template <class Functor> void CTaskMgr::CTaskJointer::StartIOTask(const Functor& inFunctor) {
+    (new TJoinableCallableTask<Functor>(inFunctor))->StartIO(this);
+}
+
+// Call inFunctor(begin, end) on sub ranges of [inBegin, inEnd[ in parallel
+template <class Index, class Functor> void CTaskMgr::ParallelFor(Index inBegin, Index inEnd, size_t inGrain, const Functor& inFunctor) {
+    if (!(inBegin < inEnd))
+        return;
+    ParallelReduce<bool>(
+        inBegin, inEnd, inGrain,
+        [&inFunctor](Index inSubBegin, Index inSubEnd) {
+            inFunctor(inSubBegin, inSubEnd);
+            return true;
+        },
+        [](bool, bool) { return true; });
+}
+
+// Return the reduction of inMap(begin, end) results of the sub ranges
+template <class Value, class Index, class Map, class Reduce>
+Value CTaskMgr::ParallelReduce(Index inBegin, Index inEnd, size_t inGrain, const Map& inMap, const Reduce& inReduce) {
+    size_t begin = size_t(inBegin);
+    size_t end = std::max(begin, size_t(inEnd));
+    if (inGrain == 0)
+        inGrain = std::max(size_t(1), (end - begin) / (size_t(mNbProcessors) * 8));
+    return ReduceRange<Value, Index>(begin, end, inGrain, inMap, inReduce);
+}
+
+// Reduce the range, the right half being computed by an other task
+template <class Value, class Index, class Map, class Reduce>
+Value CTaskMgr::ReduceRange(size_t inBegin, size_t inEnd, size_t inGrain, const Map& inMap, const Reduce& inReduce) {
+    if (inEnd - inBegin <= inGrain)
+        return inMap(Index(inBegin), Index(inEnd));
+
+    size_t middle = inBegin + (inEnd - inBegin) / 2;
+    Value right;
+    std::exception_ptr rightException; // Rethrown after the join (the jointer would only report a count)
+    CTaskJointer jointer("CTaskMgr::ReduceRange");
+    jointer.StartTask([this, &right, &rightException, middle, inEnd, inGrain, &inMap, &inReduce]() {
+        try {
+            right = ReduceRange<Value, Index>(middle, inEnd, inGrain, inMap, inReduce);
+        } catch (...) {
+            rightException = std::current_exception();
+        }
+    });
+    Value left = ReduceRange<Value, Index>(inBegin, middle, inGrain, inMap, inReduce);
+    jointer.Join();
+    if (rightException)
+        std::rethrow_exception(rightException);
+    return inReduce(std::move(left), std::move(right));
+}
+
 } // namespace Vim2Ds
@@ -0,0 +1,164 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#include "CTaskStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+namespace Vim2Ds {
+
+// Duration as text, with a unit suited to it's magnitude
+static utf8_string FormatDuration(int64_t inNanoseconds) {
+    if (inNanoseconds < 1000)
+        return Utf8StringFormat("%dns", int(inNanoseconds));
+    if (inNanoseconds < 1000000)
+        return Utf8StringFormat("%.1fus", inNanoseconds / 1e3);
+    if (inNanoseconds < 1000000000)
+        return Utf8StringFormat("%.1fms", inNanoseconds / 1e6);
+    return Utf8StringFormat("%.2fs", inNanoseconds / 1e9);
+}
+
+// Upper bound of the bucket in nanoseconds
+static int64_t BucketLimit(unsigned inBucket) {
+    return int64_t(1000) << inBucket;
+}
+
+// Add a duration
+void CTaskStats::CHistogram::Add(int64_t inNanoseconds) {
+    // Bucket is the bits count of the microseconds
+    unsigned bucket = 0;
+    for (uint64_t microseconds = uint64_t(std::max(inNanoseconds, int64_t(0))) / 1000; microseconds != 0; microseconds >>= 1)
+        ++bucket;
+    ++mBuckets[std::min(bucket, kBuckets - 1)];
+    ++mCount;
+    mTotal += inNanoseconds;
+    mMax = std::max(mMax, inNanoseconds);
+}
+
+// Add the other histogram durations
+void CTaskStats::CHistogram::Merge(const CHistogram& inOther) {
+    for (unsigned bucket = 0; bucket < kBuckets; ++bucket)
+        mBuckets[bucket] += inOther.mBuckets[bucket];
+    mCount += inOther.mCount;
+    mTotal += inOther.mTotal;
+    mMax = std::max(mMax, inOther.mMax);
+}
+
+// Upper bound of the bucket of the inFraction percentile
+int64_t CTaskStats::CHistogram::GetPercentile(double inFraction) const {
+    uint64_t rank = uint64_t(inFraction * mCount);
+    uint64_t count = 0;
+    for (unsigned bucket = 0; bucket < kBuckets; ++bucket) {
+        count += mBuckets[bucket];
+        if (count > rank)
+            return std::min(BucketLimit(bucket), mMax);
+    }
+    return mMax;
+}
+
+// Non empty buckets
+utf8_string CTaskStats::CHistogram::ToString() const {
+    utf8_string text;
+    for (unsigned bucket = 0; bucket < kBuckets; ++bucket) {
+        if (mBuckets[bucket] != 0)
+            text += Utf8StringFormat("%s<%s:%llu", text.empty() ? "" : " ", FormatDuration(BucketLimit(bucket)).c_str(),
+                                     (unsigned long long)mBuckets[bucket]);
+    }
+    return text;
+}
+
+// Constructor
+CTaskStats::CTaskStats(const utf8_string& inThreadName, bool inIsIOThread)
+: mThreadName(inThreadName)
+, mIsIOThread(inIsIOThread) {
+}
+
+// A task is done
+void CTaskStats::EndTask(const utf8_t* inType, int64_t inWait, int64_t inRun, bool inGotException) {
+    std::lock_guard<std::mutex> lock(mAccessControl);
+    if (inType != mLastType) {
+        mLastType = inType;
+        mLastTypeStats = &mTypes[inType];
+    }
+    STypeStats& type = *mLastTypeStats;
+    type.mWait.Add(inWait);
+    type.mRun.Add(inRun);
+    if (inGotException)
+        ++type.mExceptions;
+    ++mTasksCount;
+    if (--mDepth == 0)
+        mBusy += inRun;
+}
+
+// The thread slept waiting for a task
+void CTaskStats::AddSleep(int64_t inDuration) {
+    std::lock_guard<std::mutex> lock(mAccessControl);
+    ++mSleepsCount;
+    mSleeping += inDuration;
+}
+
+// The thread stole a task from a worker
+void CTaskStats::AddSteal() {
+    std::lock_guard<std::mutex> lock(mAccessControl);
+    ++mStealsCount;
+}
+
+// Print the stats of all threads
+void CTaskStats::Print(const std::vector<std::unique_ptr<CTaskStats>>& inStats, int64_t inElapsed, EP2DB inMsgLevel) {
+    // Merge the task types of all threads (I/O tasks apart)
+    std::map<std::pair<utf8_string, bool>, STypeStats> types;
+    for (const std::unique_ptr<CTaskStats>& stats : inStats) {
+        std::lock_guard<std::mutex> lock(stats->mAccessControl);
+        for (const auto& type : stats->mTypes) {
+            STypeStats& merged = types[{type.first, stats->mIsIOThread}];
+            merged.mWait.Merge(type.second.mWait);
+            merged.mRun.Merge(type.second.mRun);
+            merged.mExceptions += type.second.mExceptions;
+        }
+    }
+    if (types.empty())
+        return;
+
+    // Types by decreasing run time
+    std::vector<std::pair<const std::pair<utf8_string, bool>*, const STypeStats*>> sorted;
+    for (const auto& type : types)
+        sorted.push_back({&type.first, &type.second});
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<const std::pair<utf8_string, bool>*, const STypeStats*>& inLeft,
+                                               const std::pair<const std::pair<utf8_string, bool>*, const STypeStats*>& inRight) {
+        return inLeft.second->mRun.GetTotal() > inRight.second->mRun.GetTotal();
+    });
+
+    Printf2DB(inMsgLevel, "Tasks by type (run times include the tasks run while joining, percentiles are histogram bounds)\n");
+    for (const auto& type : sorted) {
+        const STypeStats& stats = *type.second;
+        Printf2DB(inMsgLevel, "\t%s%s count=%llu exceptions=%u\n", type.first->first.c_str(), type.first->second ? " (I/O)" : "",
+                  (unsigned long long)stats.mRun.GetCount(), stats.mExceptions);
+        Printf2DB(inMsgLevel, "\t\twait avg=%s p50=%s p99=%s max=%s\n", FormatDuration(stats.mWait.GetAverage()).c_str(),
+                  FormatDuration(stats.mWait.GetPercentile(0.5)).c_str(), FormatDuration(stats.mWait.GetPercentile(0.99)).c_str(),
+                  FormatDuration(stats.mWait.GetMax()).c_str());
+        Printf2DB(inMsgLevel, "\t\trun total=%s avg=%s p50=%s p99=%s max=%s\n", FormatDuration(stats.mRun.GetTotal()).c_str(),
+                  FormatDuration(stats.mRun.GetAverage()).c_str(), FormatDuration(stats.mRun.GetPercentile(0.5)).c_str(),
+                  FormatDuration(stats.mRun.GetPercentile(0.99)).c_str(), FormatDuration(stats.mRun.GetMax()).c_str());
+        Printf2DB(inMsgLevel, "\t\twait histogram %s\n", stats.mWait.ToString().c_str());
+        Printf2DB(inMsgLevel, "\t\trun histogram %s\n", stats.mRun.ToString().c_str());
+    }
+
+    Printf2DB(inMsgLevel, "Threads (busy: running tasks, idle: searching or sleeping) over %s\n", FormatDuration(inElapsed).c_str());
+    for (const std::unique_ptr<CTaskStats>& stats : inStats) {
+        std::lock_guard<std::mutex> lock(stats->mAccessControl);
+        int64_t idle = std::max(inElapsed - stats->mBusy, int64_t(0));
+        Printf2DB(inMsgLevel, "\t%-12s tasks=%llu busy=%s (%.1f%%) idle=%s sleeping=%s sleeps=%llu steals=%llu\n", stats->mThreadName.c_str(),
+                  (unsigned long long)stats->mTasksCount, FormatDuration(stats->mBusy).c_str(),
+                  inElapsed != 0 ? 100.0 * stats->mBusy / inElapsed : 0.0, FormatDuration(idle).c_str(), FormatDuration(stats->mSleeping).c_str(),
+                  (unsigned long long)stats->mSleepsCount, (unsigned long long)stats->mStealsCount);
+    }
+}
+
+// Current time in nanoseconds
+int64_t CTaskStats::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace Vim2Ds
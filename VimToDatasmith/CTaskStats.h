@@ -0,0 +1,98 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#pragma once
+
+#include "DebugTools.h"
+#include "VimToDatasmith.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Vim2Ds {
+
+// Scheduler telemetry of a thread: by task type, the queue wait (add to start), the run time and the exceptions count,
+// and the thread busy and sleeping times. Each thread record in it's own stats, they are merged when printed.
+class CTaskStats {
+  public:
+    // Log2 histogram of durations
+    class CHistogram {
+      public:
+        // Bucket 0 is < 1us, bucket i is [2^(i-1), 2^i[ us
+        static const unsigned kBuckets = 32;
+
+        // Add a duration
+        void Add(int64_t inNanoseconds);
+
+        // Add the other histogram durations
+        void Merge(const CHistogram& inOther);
+
+        uint64_t GetCount() const { return mCount; }
+        int64_t GetTotal() const { return mTotal; }
+        int64_t GetMax() const { return mMax; }
+        int64_t GetAverage() const { return mCount != 0 ? mTotal / int64_t(mCount) : 0; }
+
+        // Upper bound of the bucket of the inFraction percentile (inFraction in [0, 1])
+        int64_t GetPercentile(double inFraction) const;
+
+        // Non empty buckets as "<1us:12 <2us:40 ..."
+        utf8_string ToString() const;
+
+      private:
+        uint64_t mBuckets[kBuckets] = {};
+        uint64_t mCount = 0;
+        int64_t mTotal = 0;
+        int64_t mMax = 0;
+    };
+
+    // Constructor
+    CTaskStats(const utf8_string& inThreadName, bool inIsIOThread);
+
+    // A task start (nested tasks run by a joiner are part of the outer task busy time)
+    void BeginTask() { ++mDepth; }
+
+    // A task is done
+    void EndTask(const utf8_t* inType, int64_t inWait, int64_t inRun, bool inGotException);
+
+    // The thread slept waiting for a task
+    void AddSleep(int64_t inDuration);
+
+    // The thread stole a task from a worker
+    void AddSteal();
+
+    // Print the stats of all threads, inElapsed is the task manager life time
+    static void Print(const std::vector<std::unique_ptr<CTaskStats>>& inStats, int64_t inElapsed, EP2DB inMsgLevel);
+
+    // Current time in nanoseconds (steady clock)
+    static int64_t Now();
+
+  private:
+    // Stats of a task type
+    struct STypeStats {
+        CHistogram mWait;
+        CHistogram mRun;
+        uint32_t mExceptions = 0;
+    };
+
+    // Locked by the thread when it record and when the stats are printed
+    std::mutex mAccessControl;
+
+    const utf8_string mThreadName;
+    const bool mIsIOThread;
+
+    // Task types are the jointers names (string literals, so they are keyed by address)
+    std::unordered_map<const utf8_t*, STypeStats> mTypes;
+    const utf8_t* mLastType = nullptr; // Consecutive tasks are often of the same type
+    STypeStats* mLastTypeStats = nullptr;
+
+    uint32_t mDepth = 0; // Tasks being run (more than 1 when a joiner run tasks while waiting)
+    uint64_t mTasksCount = 0;
+    uint64_t mStealsCount = 0;
+    uint64_t mSleepsCount = 0;
+    int64_t mBusy = 0;
+    int64_t mSleeping = 0;
+};
+
+} // namespace Vim2Ds
@@ -16,7 +16,8 @@ class CVimToDatasmith::CTextureEntry {
         // Name of texture is the content.
         FMD5 MD5;
         MD5.Update(mImageBuffer.data.begin(), mImageBuffer.data.size());
-        CMD5Hash MD5Hash(&MD5);
+        mFileHash.Set(MD5);
+        CMD5Hash MD5Hash(mFileHash);
         mDatasmithName = MD5Hash.ToString();
         mDatasmithLabel = UTF8_TO_TCHAR(mImageBuffer.name.c_str());
     }
@@ -58,10 +59,10 @@ class CVimToDatasmith::CTextureEntry {
                    errno);
     }
 
-    // Add a texture element to the scne
-    void AddToScene() {
+    // Add a texture element to the scne, it's file is written by an I/O task
+    void AddToScene(CTaskMgr::CTaskJointer* inJointer) {
         if (!mDatasmithTexture.IsValid()) {
-            CopyTextureInAssets();
+            inJointer->StartIOTask([this]() { CopyTextureInAssets(); });
             mDatasmithTexture = FDatasmithSceneFactory::CreateTexture(*mDatasmithName);
             size_t posExtension = mImageBuffer.name.find_last_of('.');
             const char* extension = ".png";
@@ -75,8 +76,8 @@ class CVimToDatasmith::CTextureEntry {
             FString filePathName = mVimToDatasmith->mConverter.GetOutputPath() + TEXT("/Textures/") + mDatasmithName;
             filePathName += UTF8_TO_TCHAR(extension);
             mDatasmithTexture->SetFile(*filePathName);
-            FMD5Hash FileHash = FMD5Hash::HashFile(mDatasmithTexture->GetFile());
-            mDatasmithTexture->SetFileHash(FileHash);
+            // The file content is our buffer, so we don't have to read it back to hash it
+            mDatasmithTexture->SetFileHash(mFileHash);
 
             mDatasmithTexture->SetLabel(*mDatasmithLabel);
             mDatasmithTexture->SetSRGB(EDatasmithColorSpace::sRGB);
@@ -90,6 +91,7 @@ class CVimToDatasmith::CTextureEntry {
     const bfast::Buffer& mImageBuffer;
     FString mDatasmithName;
     FString mDatasmithLabel;
+    FMD5Hash mFileHash;
     TSharedPtr<IDatasmithTextureElement> mDatasmithTexture;
 };
 
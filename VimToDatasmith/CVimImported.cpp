@@ -2,50 +2,122 @@
 // Licensed under the MIT License 1.0
 
 #include "CVimImported.h"
+#include "CTaskGraph.h"
 #include "CTaskMgr.h"
+#include "SimdKernels.h"
+#include "Utf8Transcoder.h"
 #include "cMat.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace Vim2Ds {
 
-static const std::vector<int> mEmptyIntVector;
-static const std::vector<double> mEmptyDoubleVector;
+static const Vim::EntityTable mEmptyEntityTable;
 
-// Access table column (return an empty array if column isn't absent)
-const std::vector<int>& GetIndexColumn(const Vim::EntityTable& inTable, const std::string& inColumnName) {
+// Access table column (return an empty view if column isn't absent)
+Vim::ColumnView<int> GetIndexColumn(const Vim::EntityTable& inTable, const std::string& inColumnName) {
     auto iterator = inTable.mIndexColumns.find(inColumnName);
     if (iterator == inTable.mIndexColumns.end())
-        return mEmptyIntVector;
+        return Vim::ColumnView<int>();
     return iterator->second;
 }
 
-// Access table column (return an empty array if column isn't absent)
-const std::vector<StringIndex>& GetStringsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName) {
+// Access table column (return an empty view if column isn't absent)
+Vim::ColumnView<StringIndex> GetStringsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName) {
     auto iterator = inTable.mStringColumns.find(inColumnName);
     if (iterator == inTable.mStringColumns.end())
-        return reinterpret_cast<const std::vector<StringIndex>&>(mEmptyIntVector);
-    return reinterpret_cast<const std::vector<StringIndex>&>(iterator->second);
+        return Vim::ColumnView<StringIndex>();
+    return iterator->second.As<StringIndex>();
 }
 
-// Access table column (return an empty array if column isn't absent)
-const std::vector<double>& GetNumericsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName) {
+// Access table column (return an empty view if column isn't absent)
+Vim::ColumnView<double> GetNumericsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName) {
     auto iterator = inTable.mNumericColumns.find(inColumnName);
     if (iterator == inTable.mNumericColumns.end())
-        return mEmptyDoubleVector;
+        return Vim::ColumnView<double>();
     return iterator->second;
 }
 
 // Access an entities table (throw if table is absent)
 const Vim::EntityTable& CVimImported::GetEntitiesTable(const std::string& inEntityName) const {
-    auto iterator = mVimScene.mEntityTables.find(inEntityName);
-    TestAssert(iterator != mVimScene.mEntityTables.end());
-    return iterator->second;
+    const Vim::EntityTable* table = mVimScene.GetEntityTable(inEntityName);
+    TestPtr(table);
+    return *table;
+}
+
+// Access an entities table (return an empty table if table is absent)
+const Vim::EntityTable& CVimImported::FindEntitiesTable(const std::string& inEntityName) const {
+    const Vim::EntityTable* table = mVimScene.GetEntityTable(inEntityName);
+    return table != nullptr ? *table : mEmptyEntityTable;
+}
+
+// Destructor
+CVimImported::~CVimImported() {
+    if (mTCharStrings) {
+        for (size_t index = 0; index < mVimScene.mStrings.size(); ++index)
+            delete[] mTCharStrings[index].load(std::memory_order_relaxed);
+    }
+}
+
+// Convert the string and publish it in the cache
+const TCHAR* CVimImported::ConvertTCharString(StringIndex inIndex) const {
+    Vim::StringView utf8String = mVimScene.mStrings[inIndex];
+    TCHAR* converted = new TCHAR[utf8String.size() + 1];
+    converted[Utf8ToWide(utf8String.data(), utf8String.size(), converted)] = 0;
+
+    // If an other thread published it first, we use it's conversion
+    const TCHAR* expected = nullptr;
+    if (mTCharStrings[inIndex].compare_exchange_strong(expected, converted, std::memory_order_acq_rel, std::memory_order_acquire))
+        return converted;
+    delete[] converted;
+    return expected;
+}
+
+// Run the scene loading jobs concurrently on the task manager
+static void RunJobsOnTaskMgr(std::vector<std::function<void()>>& inJobs) {
+    CTaskMgr::CTaskJointer loadJobs("CVimImported::ReadStrings");
+    for (std::function<void()>& job : inJobs)
+        loadJobs.StartTask([&job]() { job(); });
+    loadJobs.Join();
+}
+
+// Open the vim file, the sections are then decoded by the Read functions
+void CVimImported::Open(const utf8_string& inVimFileName) {
+    Vim::VimErrorCodes vimReadResult = mVimScene.Open(inVimFileName);
+    if (vimReadResult != Vim::VimErrorCodes::Success)
+        ThrowMessage("CVimImported::Open - Open return error %d", vimReadResult);
+}
+
+// Decode the geometry section
+void CVimImported::ReadGeometry() {
+    Vim::VimErrorCodes vimReadResult = mVimScene.DecodeGeometry();
+    if (vimReadResult != Vim::VimErrorCodes::Success)
+        ThrowMessage("CVimImported::ReadGeometry - DecodeGeometry return error %d", vimReadResult);
+}
+
+// Index the strings section
+void CVimImported::ReadStrings() {
+    Vim::VimErrorCodes vimReadResult = mVimScene.IndexStrings(RunJobsOnTaskMgr);
+    if (vimReadResult != Vim::VimErrorCodes::Success)
+        ThrowMessage("CVimImported::ReadStrings - IndexStrings return error %d", vimReadResult);
+
+    size_t stringsCount = mVimScene.mStrings.size();
+    mTCharStrings.reset(new std::atomic<const TCHAR*>[stringsCount]);
+    for (size_t index = 0; index < stringsCount; ++index)
+        mTCharStrings[index].store(nullptr, std::memory_order_relaxed);
 }
 
-// Read the vim scene
-void CVimImported::Read(const utf8_string& inVimFileName) {
-    Vim::VimErrorCodes vimReadResult = mVimScene.ReadFile(inVimFileName);
+// Decode an entities table
+void CVimImported::ReadTable(const std::string& inEntityName) const {
+    Vim::VimErrorCodes vimReadResult = mVimScene.DecodeEntityTable(inEntityName);
     if (vimReadResult != Vim::VimErrorCodes::Success)
-        ThrowMessage("CVimImported::ReadVimFile - ReadFile return error %d", vimReadResult);
+        ThrowMessage("CVimImported::ReadTable - DecodeEntityTable(\"%s\") return error %d", inEntityName.c_str(), vimReadResult);
+}
+
+// All sections needed are decoded
+void CVimImported::DoneReading() {
+    mVimScene.DoneReading();
 #if 0
     DumpAssets();
 #endif
@@ -54,22 +126,16 @@ void CVimImported::Read(const utf8_string& inVimFileName) {
 #endif
 }
 
-// Fetch specific scene data
-void CVimImported::Prepare() {
-    VerboseF("CVimImported::Prepare\n");
-
-    CTaskMgr::CTaskJointer prepare("CVimImported::Prepare");
-    CTaskMgr::CTaskJointer convertObsolete("ConvertObsolete");
+// Index the elements of the nodes and their properties
+void CVimImported::PrepareElements() {
+    VerboseF("CVimImported::PrepareElements\n");
 
-    (new CTaskMgr::TJoinableFunctorTask<CVimImported*>([](CVimImported* inVimImporter) { inVimImporter->ConvertObsoleteSceneNode(); }, this))
-        ->Start(&convertObsolete);
-
-    Vim::EntityTable& nodeTable = mVimScene.mEntityTables["table:Vim.Node"];
-    std::vector<int>& vimNodeToVimElement = nodeTable.mIndexColumns["Element:Element"];
+    const Vim::EntityTable& nodeTable = FindEntitiesTable("table:Vim.Node");
+    Vim::ColumnView<int> vimNodeToVimElement = GetIndexColumn(nodeTable, "Element:Element");
     mVimNodeToVimElement.Initialize(vimNodeToVimElement);
 
-    Vim::EntityTable& elementTable = mVimScene.mEntityTables["table:Rvt.Element"];
-    std::vector<int>& elementToName = elementTable.mStringColumns["Name"];
+    const Vim::EntityTable& elementTable = FindEntitiesTable("table:Rvt.Element");
+    Vim::ColumnView<StringIndex> elementToName = GetStringsColumn(elementTable, "Name");
     mElementToName.Initialize(elementToName);
 
 #if 0
@@ -78,90 +144,239 @@ void CVimImported::Prepare() {
 #endif
 
     // Validate all node's element index
-    (new CTaskMgr::TJoinableFunctorTask<CVimImported*>(
-         [](CVimImported* inVimImporter) {
-             VerboseF("CVimImported::CollectAttributes - X Begin\n");
-             ElementIndex elementsCount = inVimImporter->mElementToName.Count();
-             for (ElementIndex elementIndex : inVimImporter->mVimNodeToVimElement)
-                 TestAssert(elementIndex == ElementIndex::kNoElement || elementIndex < elementsCount);
-             VerboseF("CVimImported::CollectAttributes - X End\n");
-         },
-         this))
-        ->Start(&prepare);
+    ElementIndex elementsCount = mElementToName.Count();
+    for (ElementIndex elementIndex : mVimNodeToVimElement)
+        TestAssert(elementIndex == ElementIndex::kNoElement || elementIndex < elementsCount);
+
+    IndexElementProperties();
+}
 
-    convertObsolete.Join();
+// Fetch the geometry and the instances and find the live ones
+void CVimImported::PrepareGeometry() {
+    VerboseF("CVimImported::PrepareGeometry\n");
 
-    (new CTaskMgr::TJoinableFunctorTask<CVimImported*>([](CVimImported* inVimImporter) { inVimImporter->CollectAttributes(); }, this))->Start(&prepare);
+    CTaskGraph graph("CVimImported::PrepareGeometry");
+    CTaskGraph::NodeId convertObsolete = graph.AddNode("ConvertObsoleteSceneNode", CTaskGraph::kRunOnWorker, {}, [this] { ConvertObsoleteSceneNode(); });
 
-    prepare.Join();
+    CTaskGraph::NodeId collectAttributes = graph.AddNode("CollectAttributes", CTaskGraph::kRunOnWorker, {convertObsolete}, [this] { CollectAttributes(); });
 
-    TestAssert(mVimNodeToVimElement.Count() == mInstancesSubgeometry->Count());
-    PrintStats();
+    // Run by the caller, so it's tasks are joined by the main thread
+    graph.AddNode("FixOldVimFileTransforms", CTaskGraph::kRunOnCaller, {collectAttributes}, [this] { FixOldVimFileTransforms(); });
+
+    // Reachability
+    CTaskGraph::NodeId liveGeometries = graph.AddNode("MarkLiveGeometries", CTaskGraph::kRunOnWorker, {collectAttributes}, [this] { MarkLiveGeometries(); });
+    graph.AddNode("MarkLiveVertices", CTaskGraph::kRunOnWorker, {liveGeometries}, [this] { MarkLiveVertices(); });
+    graph.AddNode("CollectLiveMaterials", CTaskGraph::kRunOnWorker, {liveGeometries}, [this] { CollectLiveMaterials(); });
+
+    graph.Run();
+    graph.PrintReport(kP2DB_Verbose);
+
+    VerboseF("CVimImported::PrepareGeometry - Live subgeometries %lu/%u, vertices %lu/%u, materials %lu\n",
+             size_t(std::count(mLiveGeometries.begin(), mLiveGeometries.end(), true)), mGroupIndexOffets.Count(),
+             size_t(std::count(mLiveVertices.begin(), mLiveVertices.end(), true)), mPositions.Count(), mLiveMaterials.size());
 }
 
-// In old vim files, the geometry is exported in world space, even when
-// instanced, so we need to remove that world transform from the geometry
-void CVimImported::FixOldVimFileTransforms() {
-    if (mVimScene.mVersionMajor == 0 && mVimScene.mVersionMinor == 0 && mVimScene.mVersionPatch <= 200) {
-        std::vector<bool> isTransformed(mGroupVertexOffets.Count(), false);
-
-        for (NodeIndex nodeIndex = NodeIndex(0); nodeIndex < mInstancesSubgeometry->Count(); nodeIndex = NodeIndex(nodeIndex + 1)) {
-            GeometryIndex subgeometry = (*mInstancesSubgeometry)[nodeIndex];
-            if (subgeometry != kNoGeometry) {
-                TestAssert(subgeometry < (int)isTransformed.size());
-                if (!isTransformed[subgeometry]) {
-                    isTransformed[subgeometry] = true;
-
-                    cMat4 invTrans = (*mInstancesTransform)[nodeIndex].Inverse();
-
-                    VertexIndex nextOffset = subgeometry < mGroupVertexOffets.Count() ? mGroupVertexOffets[GeometryIndex(subgeometry + 1)] : mPositions.Count();
-                    for (VertexIndex index = mGroupVertexOffets[subgeometry]; index < nextOffset; index = VertexIndex(index + 1)) {
-                        cVec3& vertex = mPositions[index];
-                        vertex = vertex * invTrans;
-                    }
+// Get the normals, from the file or computed (must be called from the main thread, after Prepare)
+void CVimImported::PrepareNormals() {
+    // Use the file's normals when they are valid, otherwise compute them.
+    const utf8_t* rejectReason = ValidateFileNormals();
+    if (rejectReason == nullptr) {
+        mNormals.reset(new TAttributeVector<cVec3, VertexIndex>(mFileNormals));
+        mNormalsOrigin = "file";
+    } else {
+        MeasureTime(ComputeNormals, ComputeNormals(), kP2DB_Verbose);
+        mNormalsOrigin = Utf8StringFormat("computed (%s)", rejectReason);
+    }
+    VerboseF("CVimImported::PrepareNormals - Normals %s\n", mNormalsOrigin.c_str());
+}
+
+// Mark the subgeometries instanced
+void CVimImported::MarkLiveGeometries() {
+    mLiveGeometries.assign(mGroupIndexOffets.Count(), false);
+    for (GeometryIndex geometry : *mInstancesSubgeometry) {
+        if (geometry != kNoGeometry && geometry < mGroupIndexOffets.Count())
+            mLiveGeometries[geometry] = true;
+    }
+}
+
+// Mark the vertices used by live subgeometries
+void CVimImported::MarkLiveVertices() {
+    mLiveVertices.assign(mPositions.Count(), false);
+    for (GeometryIndex g = GeometryIndex(0); g < mGroupIndexOffets.Count(); Increment(g)) {
+        if (mLiveGeometries[g]) {
+            IndiceIndex end = IndiceIndex(mGroupIndexOffets[g] + mGroupIndexCounts[g]);
+            for (IndiceIndex i = mGroupIndexOffets[g]; i < end; Increment(i)) {
+                VertexIndex vertex = mIndices[i];
+                TestAssert(vertex < mPositions.Count());
+                mLiveVertices[vertex] = true;
+            }
+        }
+    }
+}
+
+// Collect the materials used by faces of live subgeometries
+void CVimImported::CollectLiveMaterials() {
+    mLiveMaterials.clear();
+    MaterialId previous = kInvalidMaterial;
+    for (GeometryIndex g = GeometryIndex(0); g < mGroupIndexOffets.Count(); Increment(g)) {
+        if (mLiveGeometries[g]) {
+            FaceIndex start = FaceIndex(mGroupIndexOffets[g] / 3);
+            FaceIndex end = FaceIndex(std::min(uint32_t(start + mGroupIndexCounts[g] / 3), uint32_t(mMaterialIds.Count())));
+            for (FaceIndex face = start; face < end; Increment(face)) {
+                // Consecutive faces mostly share their material
+                MaterialId material = mMaterialIds[face];
+                if (material != previous) {
+                    mLiveMaterials.insert(material);
+                    previous = material;
                 }
             }
         }
     }
 }
 
+// Return true if the subgeometry faces contribute to the normal of a live vertex
+bool CVimImported::IsSubgeometryContributing(GeometryIndex inGeometry) const {
+    if (mLiveGeometries[inGeometry])
+        return true;
+    IndiceIndex end = IndiceIndex(mGroupIndexOffets[inGeometry] + mGroupIndexCounts[inGeometry]);
+    for (IndiceIndex i = mGroupIndexOffets[inGeometry]; i < end; Increment(i)) {
+        VertexIndex vertex = mIndices[i];
+        if (vertex < mPositions.Count() && mLiveVertices[vertex])
+            return true;
+    }
+    return false;
+}
+
+// Build the element to properties index
+void CVimImported::IndexElementProperties() {
+    VerboseF("CVimImported::IndexElementProperties - Begin\n");
+    mElementProperties = FindEntitiesTable("table:Rvt.Element").mProperties;
+    TestAssert(mElementProperties.size() < (uint32_t)-1);
+    uint32_t elementsCount = mElementToName.Count();
+
+    // Count the properties of each element, properties of unknown elements are ignored
+    mElementPropertiesStart.assign(size_t(elementsCount) + 1, 0);
+    bool isGrouped = true;
+    uint32_t previousElement = 0;
+    for (const Vim::SerializableProperty& property : mElementProperties) {
+        uint32_t elementIndex = uint32_t(property.mEntityId);
+        if (elementIndex < elementsCount) {
+            ++mElementPropertiesStart[elementIndex + 1];
+            isGrouped = isGrouped && elementIndex >= previousElement;
+            previousElement = elementIndex;
+        } else
+            isGrouped = false;
+    }
+    for (uint32_t elementIndex = 0; elementIndex < elementsCount; ++elementIndex)
+        mElementPropertiesStart[elementIndex + 1] += mElementPropertiesStart[elementIndex];
+
+    // Scatter the properties indices by element (stable, so properties keep their file order)
+    mElementPropertiesOrder.clear();
+    if (!isGrouped) {
+        mElementPropertiesOrder.resize(mElementPropertiesStart[elementsCount]);
+        std::vector<uint32_t> next(mElementPropertiesStart.begin(), mElementPropertiesStart.end() - 1);
+        for (uint32_t index = 0; index < uint32_t(mElementProperties.size()); ++index) {
+            uint32_t elementIndex = uint32_t(mElementProperties[index].mEntityId);
+            if (elementIndex < elementsCount)
+                mElementPropertiesOrder[next[elementIndex]++] = index;
+        }
+    }
+    VerboseF("CVimImported::IndexElementProperties - End %s\n", isGrouped ? "grouped" : "scattered");
+}
+
+// In old vim files, the geometry is exported in world space, even when
+// instanced, so we need to remove that world transform from the geometry.
+// Each subgeometry is transformed by the inverse of it's first instance transform, in parallel by subgeometries ranges.
+void CVimImported::FixOldVimFileTransforms() {
+    if (!HasWorldSpaceGeometry())
+        return;
+
+    const GeometryIndex groupCount = mGroupVertexOffets.Count();
+    std::vector<NodeIndex> definitions(groupCount, kNoNode);
+    for (NodeIndex nodeIndex = NodeIndex(0); nodeIndex < mInstancesSubgeometry->Count(); Increment(nodeIndex)) {
+        GeometryIndex subgeometry = (*mInstancesSubgeometry)[nodeIndex];
+        if (subgeometry != kNoGeometry) {
+            TestAssert(subgeometry < groupCount);
+            if (definitions[subgeometry] == kNoNode)
+                definitions[subgeometry] = nodeIndex;
+        }
+    }
+
+    // Ranges of about 64K vertices
+    const size_t kVerticesPerBatch = 64 * 1024;
+    size_t grain = std::max(size_t(1), kVerticesPerBatch * groupCount / std::max(uint32_t(1), uint32_t(mPositions.Count())));
+    CTaskMgr::Get().ParallelFor(GeometryIndex(0), groupCount, grain, [this, &definitions](GeometryIndex inStart, GeometryIndex inEnd) {
+        for (GeometryIndex g = inStart; g < inEnd; Increment(g)) {
+            if (definitions[g] != kNoNode)
+                TransformSubgeometry(g, (*mInstancesTransform)[definitions[g]].Inverse());
+        }
+    });
+}
+
+// Transform the subgeometry vertices in place
+void CVimImported::TransformSubgeometry(GeometryIndex inGeometry, const cMat4& inTransform) {
+    VertexIndex firstVertex = mGroupVertexOffets[inGeometry];
+    VertexIndex endVertex = inGeometry + 1 < mGroupVertexOffets.Count() ? mGroupVertexOffets[GeometryIndex(inGeometry + 1)] : mPositions.Count();
+    TestAssert(firstVertex <= endVertex && endVertex <= mPositions.Count());
+    if (firstVertex < endVertex)
+        TransformPoints(inTransform, &mPositions[firstVertex], endVertex - firstVertex);
+}
+
 void CVimImported::CollectAttributes() {
     TAttributeVector<cVec4> colorAttribute;
     VerboseF("CVimImported::CollectAttributes - Begin\n");
 
-    constexpr const char* ObsoleteFaceGroupId = "g3d:face:groupid:0:int32:1";
-    constexpr const char* ObsoleteGroupIndexOffset = "g3d:group:indexoffset:0:int32:1";
-    constexpr const char* ObsoleteGroupVertexOffset = "g3d:group:vertexoffset:0:int32:1";
-
+    // Attributes are identified when loaded (obsolete descriptors are mapped to the current ones)
     for (const g3d::Attribute& attr : mVimScene.mGeometry.attributes) {
-        auto descriptorString = attr.descriptor.to_string();
-        if (descriptorString == g3d::descriptors::VertexColorWithAlpha)
-            colorAttribute.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::Position)
-            mPositions.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::Index)
-            mIndices.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::FaceMaterialId)
-            mMaterialIds.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::FaceGroup || descriptorString == ObsoleteFaceGroupId)
-            mObjectIds.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::SubgeometryIndexOffset || descriptorString == ObsoleteGroupIndexOffset)
-            mGroupIndexOffets.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::SubgeometryVertexOffset || descriptorString == ObsoleteGroupVertexOffset)
-            mGroupVertexOffets.Initialize(attr);
-        else if (descriptorString == g3d::descriptors::InstanceTransform) {
-            TestAssert(!mInstancesTransform);
-            mInstancesTransform.reset(new TAttributeVector<cMat4, NodeIndex>(attr));
-        } else if (descriptorString == g3d::descriptors::InstanceParent) {
-            TestAssert(!mInstancesParent);
-            mInstancesParent.reset(new TAttributeVector<ParentIndex, NodeIndex>(attr));
-        } else if (descriptorString == g3d::descriptors::InstanceSubgeometry) {
-            TestAssert(!mInstancesSubgeometry);
-            mInstancesSubgeometry.reset(new TAttributeVector<GeometryIndex, NodeIndex>(attr));
-        } else if (descriptorString == g3d::descriptors::VertexUv)
-            mVertexUVs.Initialize(attr);
-        else
-            TraceF("Unprocessed attribute \"%s\"\n", descriptorString.c_str());
+        switch (attr.known) {
+            case g3d::KnownAttribute::vertex_color_with_alpha:
+                colorAttribute.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::position:
+                mPositions.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::index:
+                mIndices.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::face_material_id:
+                mMaterialIds.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::face_group:
+                mObjectIds.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::subgeometry_index_offset:
+                mGroupIndexOffets.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::subgeometry_vertex_offset:
+                mGroupVertexOffets.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::instance_transform:
+                TestAssert(!mInstancesTransform);
+                mInstancesTransform.reset(new TAttributeVector<cMat4, NodeIndex>(attr));
+                break;
+            case g3d::KnownAttribute::instance_parent:
+                TestAssert(!mInstancesParent);
+                mInstancesParent.reset(new TAttributeVector<ParentIndex, NodeIndex>(attr));
+                break;
+            case g3d::KnownAttribute::instance_subgeometry:
+                TestAssert(!mInstancesSubgeometry);
+                mInstancesSubgeometry.reset(new TAttributeVector<GeometryIndex, NodeIndex>(attr));
+                break;
+            case g3d::KnownAttribute::vertex_uv:
+                mVertexUVs.Initialize(attr);
+                break;
+            case g3d::KnownAttribute::vertex_normal:
+                // g3d accept it malformed, ValidateFileNormals reject it then, so normals are computed
+                mFileNormalsMalformed = attr.byte_size() % sizeof(cVec3) != 0 || reinterpret_cast<uintptr_t>(attr._begin) % alignof(cVec3) != 0;
+                if (!mFileNormalsMalformed)
+                    mFileNormals.Initialize(attr);
+                else
+                    TraceF("CVimImported::CollectAttributes - Normals attribute of %lu bytes isn't an array of cVec3\n", attr.byte_size());
+                break;
+            default:
+                TraceF("Unprocessed attribute \"%s\"\n", attr.descriptor.to_string().c_str());
+                break;
+        }
     }
 
     TestAssert(mInstancesSubgeometry && mInstancesTransform && mInstancesParent);
@@ -180,11 +395,33 @@ void CVimImported::CollectAttributes() {
         mGroupIndexCounts[GeometryIndex(groupCount - 1)] = IndiceIndex(mIndices.Count() - mGroupIndexOffets[GeometryIndex(groupCount - 1)]);
     }
 
-    FixOldVimFileTransforms();
+    VerboseF("CVimImported::CollectAttributes - End\n");
+}
 
-    MeasureTime(ComputeNormals, ComputeNormals(), kP2DB_Verbose);
+// Old vim files have their geometry in world space
+bool CVimImported::HasWorldSpaceGeometry() const {
+    return mVimScene.mVersionMajor == 0 && mVimScene.mVersionMinor == 0 && mVimScene.mVersionPatch <= 200;
+}
 
-    VerboseF("CVimImported::CollectAttributes - End\n");
+// Return nullptr if the normals of the file can be used as is, otherwise the reason they can't
+const utf8_t* CVimImported::ValidateFileNormals() const {
+    if (mFileNormalsMalformed)
+        return "malformed normals in file";
+    if (mFileNormals.Count() == 0)
+        return "no normals in file";
+    if (mFileNormals.Count() != mPositions.Count())
+        return "normals count differ from positions count";
+    // File normals would have to follow the geometry fix
+    if (HasWorldSpaceGeometry())
+        return "world space geometry";
+    const float kLengthTolerance = 0.01f;
+    for (const cVec3& normal : mFileNormals) {
+        if (!std::isfinite(normal.x) || !std::isfinite(normal.y) || !std::isfinite(normal.z))
+            return "invalid normal";
+        if (std::fabs(normal.Length() - 1.0f) > kLengthTolerance)
+            return "unnormalized normal";
+    }
+    return nullptr;
 }
 
 void CVimImported::ConvertObsoleteSceneNode() {
@@ -219,33 +456,98 @@ void CVimImported::ConvertObsoleteSceneNode() {
 }
 
 // Datasmith need normals.
+// Subgeometries own disjoint vertex ranges (when their offsets are in order), so ranges of consecutive subgeometries are
+// accumulated concurrently without synchronization. Subgeometries refering to other's vertices are accumulated after, in order.
+// Only subgeometries contributing to live vertices are accumulated, and only live vertices are normalized.
 void CVimImported::ComputeNormals() {
-    mNormals.Allocate(mPositions.Count());
-    for (IndiceIndex i = IndiceIndex(0); i < mIndices.Count(); i = IndiceIndex(i + 3)) {
-        VertexIndex vi0 = mIndices[IndiceIndex(i + 0)];
-        VertexIndex vi1 = mIndices[IndiceIndex(i + 1)];
-        VertexIndex vi2 = mIndices[IndiceIndex(i + 2)];
-        cVec3 v0 = mPositions[vi0];
-        cVec3 v1 = mPositions[vi1];
-        cVec3 v2 = mPositions[vi2];
-
-        cVec3 s0 = v2 - v0;
-        cVec3 s1 = v2 - v1;
-
-        cVec3 normal = s1 ^ s0;
-        normal.Normalise();
-
-        mNormals[vi0] -= normal;
-        mNormals[vi1] -= normal;
-        mNormals[vi2] -= normal;
+    VerboseF("CVimImported::ComputeNormals - %s kernel\n", GetSimdLevelName(GetSimdLevel()));
+    mNormals.reset(new TAllocatedVector<cVec3, VertexIndex>(mPositions.Count()));
+
+    const GeometryIndex groupCount = mGroupIndexOffets.Count();
+    bool isPartitioned = groupCount > 0 && CTaskMgr::Get().GetNbProcessors() > 1;
+    for (GeometryIndex g = GeometryIndex(0); isPartitioned && g < groupCount; Increment(g)) {
+        IndiceIndex nextOffset = g + 1 < groupCount ? mGroupIndexOffets[GeometryIndex(g + 1)] : mIndices.Count();
+        isPartitioned = mGroupIndexOffets[g] % 3 == 0 && mGroupIndexOffets[g] <= nextOffset && nextOffset <= mIndices.Count();
+
+        // Unordered vertex offsets would give overlapping vertex ranges, accumulated concurrently
+        VertexIndex nextVertex = g + 1 < groupCount ? mGroupVertexOffets[GeometryIndex(g + 1)] : mPositions.Count();
+        isPartitioned = isPartitioned && mGroupVertexOffets[g] <= nextVertex && nextVertex <= mPositions.Count();
+    }
+    if (!isPartitioned) {
+        AccumulateNormals(IndiceIndex(0), mIndices.Count());
+        NormalizeNormals(VertexIndex(0), mNormals->Count());
+        return;
+    }
+
+    // Ranges of about 48K indices, return the subgeometries not accumulated
+    typedef std::vector<GeometryIndex> GeometriesVector;
+    const size_t kIndicesPerBatch = 3 * 16 * 1024;
+    size_t grain = std::max(size_t(1), kIndicesPerBatch * groupCount / std::max(uint32_t(1), uint32_t(mIndices.Count())));
+    GeometriesVector unpartitioned = CTaskMgr::Get().ParallelReduce<GeometriesVector>(
+        GeometryIndex(0), groupCount, grain,
+        [this](GeometryIndex inStart, GeometryIndex inEnd) {
+            GeometriesVector rangeUnpartitioned;
+            for (GeometryIndex g = inStart; g < inEnd; Increment(g)) {
+                if (!IsSubgeometryContributing(g))
+                    continue;
+                IndiceIndex start = mGroupIndexOffets[g];
+                IndiceIndex end = IndiceIndex(start + mGroupIndexCounts[g]);
+                if (IsSubgeometryPartitioned(g))
+                    AccumulateNormals(start, end);
+                else
+                    rangeUnpartitioned.push_back(g);
+            }
+            return rangeUnpartitioned;
+        },
+        [](GeometriesVector inLeft, GeometriesVector inRight) {
+            inLeft.insert(inLeft.end(), inRight.begin(), inRight.end());
+            return inLeft;
+        });
+
+    // Indices before the first subgeometry and subgeometries sharing vertices
+    AccumulateNormals(IndiceIndex(0), mGroupIndexOffets[GeometryIndex(0)]);
+    for (GeometryIndex g : unpartitioned)
+        AccumulateNormals(mGroupIndexOffets[g], IndiceIndex(mGroupIndexOffets[g] + mGroupIndexCounts[g]));
+
+    const size_t kVerticesPerBatch = 64 * 1024;
+    CTaskMgr::Get().ParallelFor(VertexIndex(0), mNormals->Count(), kVerticesPerBatch,
+                                [this](VertexIndex inStart, VertexIndex inEnd) { NormalizeNormals(inStart, inEnd); });
+}
+
+// Return true if all indices of the subgeometry refer to it's own vertices
+bool CVimImported::IsSubgeometryPartitioned(GeometryIndex inGeometry) const {
+    VertexIndex firstVertex = mGroupVertexOffets[inGeometry];
+    VertexIndex endVertex = inGeometry + 1 < mGroupVertexOffets.Count() ? mGroupVertexOffets[GeometryIndex(inGeometry + 1)] : mPositions.Count();
+    IndiceIndex start = mGroupIndexOffets[inGeometry];
+    IndiceIndex end = IndiceIndex(start + mGroupIndexCounts[inGeometry]);
+    for (IndiceIndex i = start; i < end; Increment(i)) {
+        VertexIndex vertex = mIndices[i];
+        if (vertex < firstVertex || vertex >= endVertex)
+            return false;
+    }
+    return true;
+}
+
+// Accumulate the faces normals of the indices range in the vertex normals
+void CVimImported::AccumulateNormals(IndiceIndex inStart, IndiceIndex inEnd) {
+    if (inEnd <= inStart + 2)
+        return;
+    static_assert(sizeof(VertexIndex) == sizeof(uint32_t), "Kernel expect 32 bits indices");
+    AccumulateFaceNormals(mPositions.begin(), reinterpret_cast<const uint32_t*>(mIndices.begin() + inStart), (inEnd - inStart) / 3,
+                          &(*mNormals)[VertexIndex(0)]);
+}
+
+// Normalize the vertex normals range (only live ones)
+void CVimImported::NormalizeNormals(VertexIndex inStart, VertexIndex inEnd) {
+    for (VertexIndex i = inStart; i < inEnd; Increment(i)) {
+        if (mLiveVertices[i])
+            (*mNormals)[i].Normalise();
     }
-    for (VertexIndex i = VertexIndex(0); i < mNormals.Count(); i = VertexIndex(i + 1))
-        mNormals[i].Normalise();
 }
 
-void CVimImported::DumpStringColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const std::vector<int>& inColumn) const {
+void CVimImported::DumpStringColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const Vim::ColumnView<int>& inColumn) const {
     for (size_t i = 0; i < inColumn.size(); ++i)
-        TraceF("\t[\"%s\"][\"%s\"][%lu] \"%s\"\n", inTableName, inColumnName, i, GetString(StringIndex(inColumn[i])));
+        TraceF("\t[\"%s\"][\"%s\"][%lu] \"%s\"\n", inTableName, inColumnName, i, GetString(StringIndex(inColumn[i])).data());
 }
 
 void CVimImported::DumpTable(const utf8_t* inMsg, const Vim::EntityTable& inTable, bool inContent) const {
@@ -268,27 +570,27 @@ void CVimImported::DumpTable(const utf8_t* inMsg, const Vim::EntityTable& inTabl
     for (auto& property : inTable.mProperties) {
         if (previousEntityId != property.mEntityId)
             TraceF("[\"%s\"] - Property id=%d\n", inMsg, property.mEntityId);
-        TraceF("\t\t{ Name=\"%s\" Value=\"%s\" }\n", GetString(StringIndex(property.mName)), GetString(StringIndex(property.mValue)));
+        TraceF("\t\t{ Name=\"%s\" Value=\"%s\" }\n", GetString(StringIndex(property.mName)).data(), GetString(StringIndex(property.mValue)).data());
         previousEntityId = property.mEntityId;
     }
     TraceF("\n");
 }
 
 void CVimImported::DumpAssets() const {
-    TraceF("Assets count= %ld\n", mVimScene.mAssetsBFast.buffers.size());
-    for (const auto& asset : mVimScene.mAssetsBFast.buffers)
+    TraceF("Assets count= %ld\n", GetAssetsBuffer().size());
+    for (const auto& asset : GetAssetsBuffer())
         TraceF("\t%s\n", asset.name.c_str());
 }
 
 void CVimImported::DumpEntitiesTables() const {
-    for (auto table : mVimScene.mEntityTables)
-        DumpTable(table.first.c_str(), table.second, true);
+    for (const auto& table : mVimScene.mEntityTables)
+        DumpTable(table.first.c_str(), table.second->Get(), true);
 }
 
 // Print selected contents
 void CVimImported::PrintStats() {
-    VerboseF("Positions %u, Indices=%u, Groups=%u, Instances=%u, Strings=%lu\n", mPositions.Count(), mIndices.Count(), mGroupVertexOffets.Count(),
-             mInstancesSubgeometry->Count(), mVimScene.mStrings.size());
+    VerboseF("Positions %u, Indices=%u, Groups=%u, Instances=%u, Strings=%lu, Normals %s\n", mPositions.Count(), mIndices.Count(),
+             mGroupVertexOffets.Count(), mInstancesSubgeometry->Count(), mVimScene.mStrings.size(), mNormalsOrigin.c_str());
 
 #if 0
 #if 0
@@ -318,7 +620,7 @@ void CVimImported::PrintStats() {
 #if 0
     TraceF("String count %lu\n", mVimScene.mStrings.size());
     for (size_t index = 0; index < mVimScene.mStrings.size(); ++index)
-        TraceF("\t%lu \"%s\"\n", index, mVimScene.mStrings[index]);
+        TraceF("\t%lu \"%s\"\n", index, mVimScene.mStrings[index].data());
 #endif
 
 #if 0
@@ -326,9 +628,7 @@ void CVimImported::PrintStats() {
     for (const auto& entity : mVimScene.mEntityTables)
         TraceF("\t%s\n", entity.first.c_str());
     
-    TraceF("Assets count= %ld\n", mVimScene.mAssetsBFast.buffers.size());
-    for (const auto& asset : mVimScene.mAssetsBFast.buffers)
-        TraceF("\t%s\n", asset.name.c_str());
+    DumpAssets();
     
     mPositions.Print("Positions");
     mIndices.Print("Indices");
@@ -10,41 +10,86 @@
 
 DISABLE_SDK_WARNINGS_START
 
+#include "CoreTypes.h"
 #include "vim.h"
 
 DISABLE_SDK_WARNINGS_END
 
+#include <atomic>
+#include <unordered_set>
+
 namespace Vim2Ds {
 
 class CVimImported {
   public:
     CVimImported() {}
 
-    // Read the vim scene
-    void Read(const utf8_string& inVimFileName);
+    // Destructor
+    ~CVimImported();
+
+    // Open the vim file, the sections are then decoded by the Read functions (in any order, concurrently)
+    void Open(const utf8_string& inVimFileName);
+
+    // Decode the geometry section
+    void ReadGeometry();
+
+    // Index the strings section
+    void ReadStrings();
+
+    // Decode an entities table (other tables are decoded on first access)
+    void ReadTable(const std::string& inEntityName) const;
+
+    // All sections needed are decoded
+    void DoneReading();
+
+    // Fetch the geometry and the instances and find the live ones (must be called from the main thread, after ReadGeometry)
+    void PrepareGeometry();
+
+    // Index the elements of the nodes and their properties (after the nodes and elements tables are read)
+    void PrepareElements();
+
+    // Get the normals, from the file or computed (must be called from the main thread, after PrepareGeometry)
+    void PrepareNormals();
 
-    // Fetch specific scene data
-    void Prepare();
+    // Return true if a face of an instanced subgeometry use this material
+    bool IsMaterialLive(MaterialId inMaterialId) const { return mLiveMaterials.find(inMaterialId) != mLiveMaterials.end(); }
 
-    // Return string by it's StringIndex
-    const utf8_t* GetString(StringIndex inIndex) const {
+    // Return string by it's StringIndex (the view data is zero terminated)
+    Vim::StringView GetString(StringIndex inIndex) const {
         TestAssert(inIndex < mVimScene.mStrings.size());
-        return reinterpret_cast<const utf8_t*>(mVimScene.mStrings[inIndex]);
+        return mVimScene.mStrings[inIndex];
     }
 
     // Return string by it's index in a StringIndex array
-    const utf8_t* GetString(const std::vector<StringIndex>& inStringIndex, size_t inIndex) const {
+    Vim::StringView GetString(const Vim::ColumnView<StringIndex>& inStringIndex, size_t inIndex) const {
         if (inIndex >= inStringIndex.size())
-            return "";
+            return Vim::StringView();
         return GetString(inStringIndex[inIndex]);
     }
 
-    // Get the assets buffer (... list of textures ...)
-    const bfast::vector<bfast::Buffer>& GetAssetsBuffer() const { return mVimScene.mAssetsBFast.buffers; }
+    // Return string converted to TCHAR, converted on first access then shared (lock free, thread safe)
+    const TCHAR* GetTCharString(StringIndex inIndex) const {
+        TestAssert(inIndex < mVimScene.mStrings.size());
+        const TCHAR* tcharString = mTCharStrings[inIndex].load(std::memory_order_acquire);
+        return tcharString != nullptr ? tcharString : ConvertTCharString(inIndex);
+    }
+
+    // Return TCHAR string by it's index in a StringIndex array
+    const TCHAR* GetTCharString(const Vim::ColumnView<StringIndex>& inStringIndex, size_t inIndex) const {
+        if (inIndex >= inStringIndex.size())
+            return TEXT("");
+        return GetTCharString(inStringIndex[inIndex]);
+    }
+
+    // Get the assets buffer (... list of textures ...), assets are unpacked on first call
+    const bfast::vector<bfast::Buffer>& GetAssetsBuffer() const { return mVimScene.GetAssets().buffers; }
 
-    // Access an entities table (throw if table is absent)
+    // Access an entities table, decoded on first access (throw if table is absent)
     const Vim::EntityTable& GetEntitiesTable(const std::string& inEntityName) const;
 
+    // Access an entities table, decoded on first access (return an empty table if table is absent)
+    const Vim::EntityTable& FindEntitiesTable(const std::string& inEntityName) const;
+
     // Readed scene data
     TAttributeVector<cVec3, VertexIndex> mPositions;
     TAttributeVector<VertexIndex, IndiceIndex> mIndices;
@@ -58,12 +103,31 @@ class CVimImported {
     TIndexor<ElementIndex, NodeIndex> mVimNodeToVimElement;
     TIndexor<StringIndex, ElementIndex> mElementToName;
 
+    // Call inFunctor(const Vim::SerializableProperty&) for each property of the element
+    template <class Functor> void ForEachElementProperty(ElementIndex inElementIndex, Functor inFunctor) const {
+        uint32_t start = mElementPropertiesStart[inElementIndex];
+        uint32_t end = mElementPropertiesStart[inElementIndex + 1];
+        if (mElementPropertiesOrder.empty()) {
+            for (uint32_t index = start; index < end; ++index)
+                inFunctor(mElementProperties[index]);
+        } else {
+            for (uint32_t index = start; index < end; ++index)
+                inFunctor(mElementProperties[mElementPropertiesOrder[index]]);
+        }
+    }
+
     // Working/Computed data
     TAllocatedVector<IndiceIndex, GeometryIndex> mGroupIndexCounts;
-    TAllocatedVector<cVec3, VertexIndex> mNormals;
+    std::unique_ptr<TVector<cVec3, VertexIndex>> mNormals; // Bound to the file's normals when valid, computed otherwise
+    utf8_string mNormalsOrigin; // Which path provided the normals (for the report)
+
+    // Reachable data: subgeometries instanced, the vertices they use and the materials of their faces
+    std::vector<bool> mLiveGeometries;
+    std::vector<bool> mLiveVertices;
+    std::unordered_set<MaterialId> mLiveMaterials;
 
     // For data exploration
-    void DumpStringColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const std::vector<int>& inColumn) const;
+    void DumpStringColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const Vim::ColumnView<int>& inColumn) const;
     void DumpTable(const utf8_t* inMsg, const Vim::EntityTable& inTable, bool inContent) const;
     void DumpAssets() const;
     void DumpEntitiesTables() const;
@@ -73,33 +137,83 @@ class CVimImported {
   private:
     void CollectAttributes();
 
+    // Build the element to properties index
+    void IndexElementProperties();
+
     // In old vim files, the geometry is exported in world space, even when
     // instanced, so we need to remove that world transform from the geometry
     void FixOldVimFileTransforms();
 
+    // Transform the subgeometry vertices in place
+    void TransformSubgeometry(GeometryIndex inGeometry, const cMat4& inTransform);
+
     void ConvertObsoleteSceneNode();
 
+    // Mark the subgeometries instanced
+    void MarkLiveGeometries();
+
+    // Mark the vertices used by live subgeometries
+    void MarkLiveVertices();
+
+    // Collect the materials used by faces of live subgeometries
+    void CollectLiveMaterials();
+
+    // Return true if the subgeometry faces contribute to the normal of a live vertex
+    bool IsSubgeometryContributing(GeometryIndex inGeometry) const;
+
+    // Old vim files have their geometry in world space
+    bool HasWorldSpaceGeometry() const;
+
+    // Return nullptr if the normals of the file can be used as is, otherwise the reason they can't
+    const utf8_t* ValidateFileNormals() const;
+
     // Datasmith need normals.
     void ComputeNormals();
 
+    // Return true if all indices of the subgeometry refer to it's own vertices
+    bool IsSubgeometryPartitioned(GeometryIndex inGeometry) const;
+
+    // Accumulate the faces normals of the indices range in the vertex normals
+    void AccumulateNormals(IndiceIndex inStart, IndiceIndex inEnd);
+
+    // Normalize the vertex normals range (only live ones)
+    void NormalizeNormals(VertexIndex inStart, VertexIndex inEnd);
+
+    // Convert the string and publish it in the cache
+    const TCHAR* ConvertTCharString(StringIndex inIndex) const;
+
     Vim::Scene mVimScene;
 
+    // Normals of the file (empty if absent or malformed)
+    TAttributeVector<cVec3, VertexIndex> mFileNormals;
+    bool mFileNormalsMalformed = false; // Normals attribute size or alignment doesn't fit cVec3
+
+    // Strings converted to TCHAR, indexed by StringIndex (nullptr until first access)
+    std::unique_ptr<std::atomic<const TCHAR*>[]> mTCharStrings;
+
+    // Compressed sparse row index of the element table properties: properties of element e are
+    // [mElementPropertiesStart[e], mElementPropertiesStart[e + 1]) in mElementPropertiesOrder,
+    // or directly in mElementProperties when the file has them already grouped by element (mElementPropertiesOrder is then empty)
+    Vim::ColumnView<Vim::SerializableProperty> mElementProperties;
+    std::vector<uint32_t> mElementPropertiesStart;
+    std::vector<uint32_t> mElementPropertiesOrder;
+
     // Unprocessed vim data
     TAttributeVector<uint32_t> mObjectIds;
     TAttributeVector<float> mVertexUVs;
 };
 
-// Access table column (return an empty array if column isn't absent)
-const std::vector<int>& GetIndexColumn(const Vim::EntityTable& inTable, const std::string& inColumnName);
-const std::vector<StringIndex>& GetStringsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName);
-const std::vector<double>& GetNumericsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName);
+// Access table column (return an empty view if column isn't absent). Views point into the vim file data.
+Vim::ColumnView<int> GetIndexColumn(const Vim::EntityTable& inTable, const std::string& inColumnName);
+Vim::ColumnView<StringIndex> GetStringsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName);
+Vim::ColumnView<double> GetNumericsColumn(const Vim::EntityTable& inTable, const std::string& inColumnName);
 
-inline void DumpIndexColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const std::vector<int>& inColumn) {
+inline void DumpIndexColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const Vim::ColumnView<int>& inColumn) {
     for (size_t i = 0; i < inColumn.size(); ++i)
         TraceF("\t[\"%s\"][\"%s\"][%lu] %d\n", inTableName, inColumnName, i, inColumn[i]);
 }
 
-inline void DumpNumericColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const std::vector<double>& inColumn) {
+inline void DumpNumericColumn(const utf8_t* inTableName, const utf8_t* inColumnName, const Vim::ColumnView<double>& inColumn) {
     for (size_t i = 0; i < inColumn.size(); ++i)
         TraceF("\t[\"%s\"][\"%s\"][%lu] %lf\n", inTableName, inColumnName, i, inColumn[i]);
 }
@@ -9,6 +9,8 @@
 #include "CMetadatasProcessor.h"
 #include "CTextureEntry.h"
 
+#include <algorithm>
+
 namespace Vim2Ds {
 
 // Constructor
@@ -49,24 +51,28 @@ void CVimToDatasmith::CreateMaterials() {
     VerboseF("CVimToDatasmith::CreateMaterials\n");
     const Vim::EntityTable& materialTable = mVim.GetEntitiesTable("table:Rvt.Material");
 
-    const std::vector<StringIndex>& nameArray = GetStringsColumn(materialTable, "Name");
-    const std::vector<StringIndex>& textureNameArray = GetStringsColumn(materialTable, "ColorTextureFile");
-    const std::vector<double>& idArray = GetNumericsColumn(materialTable, "Id");
-    const std::vector<double>& colorXArray = GetNumericsColumn(materialTable, "Color.X");
-    const std::vector<double>& colorYArray = GetNumericsColumn(materialTable, "Color.Y");
-    const std::vector<double>& colorZArray = GetNumericsColumn(materialTable, "Color.Z");
-    const std::vector<double>& transparencyArray = GetNumericsColumn(materialTable, "Transparency");
-    const std::vector<double>& glossinessArray = GetNumericsColumn(materialTable, "Glossiness");
-    const std::vector<double>& smoothnessArray = GetNumericsColumn(materialTable, "Smoothness");
+    const Vim::ColumnView<StringIndex> nameArray = GetStringsColumn(materialTable, "Name");
+    const Vim::ColumnView<StringIndex> textureNameArray = GetStringsColumn(materialTable, "ColorTextureFile");
+    const Vim::ColumnView<double> idArray = GetNumericsColumn(materialTable, "Id");
+    const Vim::ColumnView<double> colorXArray = GetNumericsColumn(materialTable, "Color.X");
+    const Vim::ColumnView<double> colorYArray = GetNumericsColumn(materialTable, "Color.Y");
+    const Vim::ColumnView<double> colorZArray = GetNumericsColumn(materialTable, "Color.Z");
+    const Vim::ColumnView<double> transparencyArray = GetNumericsColumn(materialTable, "Transparency");
+    const Vim::ColumnView<double> glossinessArray = GetNumericsColumn(materialTable, "Glossiness");
+    const Vim::ColumnView<double> smoothnessArray = GetNumericsColumn(materialTable, "Smoothness");
 
     for (size_t i = 0; i < idArray.size(); i++) {
         MaterialId vimMaterialId = (MaterialId)idArray[i];
 
+        // Skip materials of no instanced face (1st one is kept, it's the default for unknown material ids)
+        if (i != 0 && !mVim.IsMaterialLive(vimMaterialId))
+            continue;
+
         VerboseF("CVimToDatasmith::CreateMaterials - MaterialId = %u\n", vimMaterialId);
 
         auto previous = mVimToDatasmithMaterialMap.find(vimMaterialId);
         if (previous != mVimToDatasmithMaterialMap.end()) {
-            DebugF("MaterialId %u \"%s\" duplicated Index=%lu vs %lu\n", vimMaterialId, mVim.GetString(nameArray, i), i, previous->second);
+            DebugF("MaterialId %u \"%s\" duplicated Index=%lu vs %lu\n", vimMaterialId, mVim.GetString(nameArray, i).data(), i, previous->second);
             continue;
         }
         mVimToDatasmithMaterialMap[vimMaterialId] = mMaterials.size();
@@ -81,13 +87,16 @@ void CVimToDatasmith::CreateMaterials() {
         materialEntry.mParams.x = glossinessArray.size() > i ? (float)glossinessArray[i] / 256.0f : 0.5f;
         materialEntry.mParams.y = smoothnessArray.size() > i ? (float)smoothnessArray[i] / 256.0f : 50.0f / 256.0f;
 
-        const utf8_t* textureName = mVim.GetString(textureNameArray, i);
-        if (*textureName)
-            materialEntry.mTexture = CreateTexture(textureName);
+        Vim::StringView textureName = mVim.GetString(textureNameArray, i);
+        if (!textureName.empty())
+            materialEntry.mTexture = CreateTexture(textureName.data());
 
         IDatasmithUEPbrMaterialElement& element = materialEntry.mMaterialElement.Get();
-        const utf8_t* materialName = mVim.GetString(nameArray, i);
-        element.SetLabel(UTF8_TO_TCHAR((*materialName ? materialName : Utf8StringFormat("Vim %d", vimMaterialId).c_str())));
+        const TCHAR* materialName = mVim.GetTCharString(nameArray, i);
+        if (*materialName)
+            element.SetLabel(materialName);
+        else
+            element.SetLabel(UTF8_TO_TCHAR(Utf8StringFormat("Vim %d", vimMaterialId).c_str()));
 
         if (materialEntry.mTexture != nullptr) {
             IDatasmithMaterialExpressionTexture* baseTextureExpression = element.AddMaterialExpression<IDatasmithMaterialExpressionTexture>();
@@ -120,15 +129,15 @@ void CVimToDatasmith::CreateAllMetaDatas() {
 #if 1 // Threaded version retained
     CMetadatasProcessor(this).Process();
 #else
-    Vim::EntityTable& elementTable = mVimScene.mEntityTables["table:Rvt.Element"];
+    const Vim::EntityTable& elementTable = mVim.GetEntitiesTable("table:Rvt.Element");
     for (auto& property : elementTable.mProperties) {
         ElementIndex elementIndex = ElementIndex(property.mEntityId);
         if (elementIndex != ElementIndex::kNoElement || elementIndex < mVecElementToActors.size()) {
             CActorEntry& actorEntry = mVecElementToActors[elementIndex];
             if (actorEntry.HasElement()) {
                 TSharedPtr<IDatasmithKeyValueProperty> dsProperty =
-                    FDatasmithSceneFactory::CreateKeyValueProperty(UTF8_TO_TCHAR(mVim.GetString(StringIndex(property.mName))));
-                dsProperty->SetValue(UTF8_TO_TCHAR(mVim.GetString(StringIndex(property.mValue))));
+                    FDatasmithSceneFactory::CreateKeyValueProperty(mVim.GetTCharString(StringIndex(property.mName)));
+                dsProperty->SetValue(mVim.GetTCharString(StringIndex(property.mValue)));
                 dsProperty->SetPropertyType(EDatasmithKeyValuePropertyType::String);
                 actorEntry.GetOrCreateMetadataElement(this).AddProperty(dsProperty);
             }
@@ -142,12 +151,12 @@ void CVimToDatasmith::CreateAllMetaDatas() {
 void CVimToDatasmith::CreateAllTags() {
     mConverter.mBuildTagsTimeStat.BeginNow();
     const Vim::EntityTable& elementTable = mVim.GetEntitiesTable("table:Rvt.Element");
-    const std::vector<int>& elementToLevel = GetIndexColumn(elementTable, "Level:Level");
-    const std::vector<int>& elementToCategory = GetIndexColumn(elementTable, "Category:Category");
-    const std::vector<int>& elementToRoom = GetIndexColumn(elementTable, "Room:Room");
-    const std::vector<StringIndex>& elementToFamilyName = GetStringsColumn(elementTable, "FamilyName");
-    const std::vector<StringIndex>& elementToType = GetStringsColumn(elementTable, "Type");
-    const std::vector<double>& elementToId = GetNumericsColumn(elementTable, "Id");
+    const Vim::ColumnView<int> elementToLevel = GetIndexColumn(elementTable, "Level:Level");
+    const Vim::ColumnView<int> elementToCategory = GetIndexColumn(elementTable, "Category:Category");
+    const Vim::ColumnView<int> elementToRoom = GetIndexColumn(elementTable, "Room:Room");
+    const Vim::ColumnView<StringIndex> elementToFamilyName = GetStringsColumn(elementTable, "FamilyName");
+    const Vim::ColumnView<StringIndex> elementToType = GetStringsColumn(elementTable, "Type");
+    const Vim::ColumnView<double> elementToId = GetNumericsColumn(elementTable, "Id");
 
     for (ElementIndex elementIndex = ElementIndex(0); elementIndex < ElementIndex(mVecElementToActors.size()); Increment(elementIndex)) {
         IDatasmithActorElement* actor = mVecElementToActors[elementIndex].GetActorElement();
@@ -172,24 +181,25 @@ void CVimToDatasmith::CreateAllTags() {
             if (elementIndex < elementToFamilyName.size()) {
                 StringIndex familyName = StringIndex(elementToFamilyName[elementIndex]);
                 if (familyName != -1)
-                    actor->AddTag(*FString::Printf(TEXT("VIM.Family.%s"), UTF8_TO_TCHAR(mVim.GetString(familyName))));
+                    actor->AddTag(*FString::Printf(TEXT("VIM.Family.%s"), mVim.GetTCharString(familyName)));
             }
             if (elementIndex < elementToType.size()) {
                 StringIndex typeString = StringIndex(elementToType[elementIndex]);
                 if (typeString != -1)
-                    actor->AddTag(*FString::Printf(TEXT("VIM.Type.%s"), UTF8_TO_TCHAR(mVim.GetString(typeString))));
+                    actor->AddTag(*FString::Printf(TEXT("VIM.Type.%s"), mVim.GetTCharString(typeString)));
             }
         }
     }
     mConverter.mBuildTagsTimeStat.FinishNow();
 }
 
-// Create all definitions
-void CVimToDatasmith::ProcessInstances() {
+// Create all definitions (the geometries are converted by tasks started on inJointer)
+void CVimToDatasmith::ProcessInstances(CTaskMgr::CTaskJointer* inJointer) {
     VerboseF("CVimToDatasmith::ProcessDefinitions\n");
     mGeometryEntries.resize(mVim.mGroupIndexOffets.Count());
     mVecElementToActors.resize(mVim.mElementToName.Count());
 
+    // Collect the instances of each geometry before starting it's task, since the task create the actors
     for (NodeIndex nodeIndex = NodeIndex(0); nodeIndex < mVim.mInstancesSubgeometry->Count(); nodeIndex = NodeIndex(nodeIndex + 1)) {
         GeometryIndex geometryIndex = (*mVim.mInstancesSubgeometry)[nodeIndex];
 
@@ -203,46 +213,63 @@ void CVimToDatasmith::ProcessInstances() {
                 geometryEntry->AddInstance(nodeIndex);
         }
     }
-}
-
-// Create all actors
-void CVimToDatasmith::CreateActors() {
-    VerboseF("CVimToDatasmith::CreateActors\n");
 
     for (auto& geometry : mGeometryEntries)
         if (geometry != nullptr)
-            geometry->CreateActors();
+            geometry->Start(inJointer);
+}
+
+// Record the actor name, duplicates are renamed by RenameDuplicateActors (must be called with mActorsAccessControl locked)
+void CVimToDatasmith::RegisterActorName(const TSharedRef<IDatasmithActorElement>& inActor, NodeIndex inInstance) {
+    // Actors are created in parallel, so to have the same names on each conversion the lowest instance keep the
+    // name, the others will be suffixed by their instance.
+    utf8_string name(TCHAR_TO_UTF8(inActor->GetName()));
+    auto insertResult = mActorsNames.insert({name, SActorName{inInstance, &inActor.Get()}});
+    if (!insertResult.second) {
+        SActorName duplicate{inInstance, &inActor.Get()};
+        if (inInstance < insertResult.first->second.mInstance)
+            std::swap(duplicate, insertResult.first->second);
+        mDuplicateActors.push_back(duplicate);
+    }
+}
+
+// Rename the actors with a duplicate name (all geometry tasks must be done, since they still access their actors)
+void CVimToDatasmith::RenameDuplicateActors() {
+    std::sort(mDuplicateActors.begin(), mDuplicateActors.end(),
+              [](const SActorName& inLeft, const SActorName& inRight) { return inLeft.mInstance < inRight.mInstance; });
+    for (const SActorName& duplicate : mDuplicateActors) {
+        utf8_string occurenceName = Utf8StringFormat("%s_Occurence_%u", TCHAR_TO_UTF8(duplicate.mActor->GetName()), duplicate.mInstance);
+        duplicate.mActor->SetName(UTF8_TO_TCHAR(occurenceName.c_str()));
+        VerboseF("Duplicate actor name %s - instance %u\n", occurenceName.c_str(), duplicate.mInstance);
+    }
+    mDuplicateActors.clear();
 }
 
 // Add Datasmith materials used to the scene
 void CVimToDatasmith::AddUsedMaterials() {
+    CTaskMgr::CTaskJointer copyTextures("CVimToDatasmith::AddUsedMaterials");
     for (auto& material : mMaterials) {
         if (material.mCount > 0) {
             if (material.mTexture != nullptr) {
-                material.mTexture->AddToScene();
+                material.mTexture->AddToScene(&copyTextures);
             }
             std::unique_lock<std::mutex> lk(mConverter.GetSceneAccess());
             mConverter.GetScene()->AddMaterial(material.mMaterialElement);
         }
     }
+    copyTextures.Join();
 }
 
-void CVimToDatasmith::ConvertScene() {
-    ConvertGeometries();
-    CreateActors();
-    AddUsedMaterials();
-    CreateAllMetaDatas();
-    CreateAllTags();
-}
-
+// Create the meshes and the actors of all instanced geometries
 void CVimToDatasmith::ConvertGeometries() {
-    try {
-        ProcessInstances();
-    } catch (...) {
-        CTaskMgr::DeleteMgr(); // Kill all tasks
-        throw;
-    }
-    CTaskMgr::Get().Join();
+    TestAssert(mVim.mVimNodeToVimElement.Count() == mVim.mInstancesSubgeometry->Count());
+
+    // On exception, the jointer's destructor wait for the tasks already started
+    CTaskMgr::CTaskJointer jointer("CVimToDatasmith::ConvertGeometries");
+    ProcessInstances(&jointer);
+    jointer.Join();
+
+    RenameDuplicateActors();
 }
 
 // Return the material name
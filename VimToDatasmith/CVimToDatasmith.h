@@ -57,10 +57,16 @@ class CVimToDatasmith {
     // Destructor
     ~CVimToDatasmith();
 
-    void ConvertScene();
-
+    // Create the meshes and the actors of all instanced geometries
     void ConvertGeometries();
 
+    // Add Datasmith materials used to the scene
+    void AddUsedMaterials();
+
+    void CreateAllMetaDatas();
+
+    void CreateAllTags();
+
     // Return the material name
     const TCHAR* GetMaterialName(MaterialId inVimMaterialId) const;
 
@@ -74,18 +80,14 @@ class CVimToDatasmith {
     // Get or create a texture entry
     CTextureEntry* CreateTexture(const utf8_t* inTextureName);
 
-    // Create all definitions
-    void ProcessInstances();
-
-    // Create all actors
-    void CreateActors();
+    // Create all definitions (the geometries are converted by tasks started on inJointer)
+    void ProcessInstances(CTaskMgr::CTaskJointer* inJointer);
 
-    // Add Datasmith materials used to the scene
-    void AddUsedMaterials();
+    // Record the actor name, duplicates are renamed by RenameDuplicateActors (must be called with mActorsAccessControl locked)
+    void RegisterActorName(const TSharedRef<IDatasmithActorElement>& inActor, NodeIndex inInstance);
 
-    void CreateAllMetaDatas();
-
-    void CreateAllTags();
+    // Rename the actors with a duplicate name (all geometry tasks must be done)
+    void RenameDuplicateActors();
 
     // All collected materials
     std::vector<CMaterialEntry> mMaterials;
@@ -104,10 +106,18 @@ class CVimToDatasmith {
     // List of already created mesh assets (the key is the MD5Hash of the mesh definition)
     std::unordered_map<CMD5Hash, std::unique_ptr<CMeshDefinition>, CMD5Hash::SHasher> mMeshDefinitions;
     std::mutex mDefinitionsAccessControl;
+    std::mutex mMeshElementsAccessControl; // Control mesh elements creation (they are shared by geometries)
 
     std::vector<std::unique_ptr<CGeometryEntry>> mGeometryEntries; // vector of geometries
 
-    std::map<std::string, const CGeometryEntry*> mMapInstancesNameToGeometry; // To detect name duplicate
+    // Actor using the name (to detect name duplicate)
+    struct SActorName {
+        NodeIndex mInstance;
+        IDatasmithActorElement* mActor;
+    };
+    std::unordered_map<utf8_string, SActorName> mActorsNames;
+    std::vector<SActorName> mDuplicateActors; // Actors to be renamed
+    std::mutex mActorsAccessControl; // Control access to mActorsNames, mDuplicateActors and mVecElementToActors
 
     std::mutex mMultiPurposeAccessControl;
 };
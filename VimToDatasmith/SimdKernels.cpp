@@ -0,0 +1,360 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#include "SimdKernels.h"
+
+#include "cMat.h"
+
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+#define VIM2DS_USE_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compile intrinsics of any instruction set without per function target
+#define VIM2DS_TARGET(inTarget)
+#else
+#define VIM2DS_TARGET(inTarget) __attribute__((target(inTarget)))
+#endif
+#endif
+
+static_assert(sizeof(cVec3) == 3 * sizeof(float), "Kernels expect tightly packed cVec3");
+
+namespace Vim2Ds {
+
+// Triangles processed by each SoA step
+static const size_t kTrianglesPerStep = 8;
+
+// Detect the best instruction set usable
+static ESimdLevel DetectSimdLevel() {
+#if VIM2DS_USE_X86_SIMD
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse41 = __builtin_cpu_supports("sse4.1");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2)
+        return kSimdAVX2;
+    if (sse41)
+        return kSimdSSE4;
+#endif
+    return kSimdScalar;
+}
+
+static const ESimdLevel sSupportedLevel = DetectSimdLevel();
+static std::atomic<ESimdLevel> sSimdLevel(sSupportedLevel);
+
+// Best instruction set supported by the processor and the OS (detected once)
+ESimdLevel GetSimdLevel() {
+    return sSimdLevel.load(std::memory_order_relaxed);
+}
+
+// Restrict the kernels to inLevel (capped to the supported level)
+void SetSimdLevel(ESimdLevel inLevel) {
+    sSimdLevel.store(inLevel < sSupportedLevel ? inLevel : sSupportedLevel, std::memory_order_relaxed);
+}
+
+// Name of the level, for traces
+const utf8_t* GetSimdLevelName(ESimdLevel inLevel) {
+    switch (inLevel) {
+        case kSimdScalar:
+            return "Scalar";
+        case kSimdSSE4:
+            return "SSE4";
+        case kSimdAVX2:
+            return "AVX2";
+    }
+    return "Unknown";
+}
+
+// Scalar reference, same operations as cVec3 ^ and Normalise
+static void AccumulateFaceNormalsScalar(const cVec3* inPositions, const uint32_t* inIndices, size_t inTrianglesCount, cVec3* ioNormals) {
+    for (size_t t = 0; t < inTrianglesCount; ++t, inIndices += 3) {
+        const cVec3& v0 = inPositions[inIndices[0]];
+        const cVec3& v1 = inPositions[inIndices[1]];
+        const cVec3& v2 = inPositions[inIndices[2]];
+
+        cVec3 s0 = v2 - v0;
+        cVec3 s1 = v2 - v1;
+
+        cVec3 normal = s1 ^ s0;
+        normal.Normalise();
+
+        ioNormals[inIndices[0]] -= normal;
+        ioNormals[inIndices[1]] -= normal;
+        ioNormals[inIndices[2]] -= normal;
+    }
+}
+
+// Subtract the SoA normals of a step to the normals of the triangle's vertices.
+// Done in triangle order since a vertex can be shared by triangles of the same step.
+static inline void ScatterNormals(const float* inX, const float* inY, const float* inZ, const uint32_t* inIndices, cVec3* ioNormals) {
+    for (size_t t = 0; t < kTrianglesPerStep; ++t, inIndices += 3) {
+        for (size_t v = 0; v < 3; ++v) {
+            cVec3& normal = ioNormals[inIndices[v]];
+            normal.x -= inX[t];
+            normal.y -= inY[t];
+            normal.z -= inZ[t];
+        }
+    }
+}
+
+#if VIM2DS_USE_X86_SIMD
+
+// Normals of 4 triangles, SoA: cross product of (v2 - v1) and (v2 - v0) normalized (unless exactly zero)
+VIM2DS_TARGET("sse4.1")
+static inline void FaceNormalsSSE4(const float* inPositions, const uint32_t* inIndices, float* outX, float* outY, float* outZ) {
+    __m128 p[3][3];
+    for (int v = 0; v < 3; ++v) {
+        const float* a = inPositions + size_t(inIndices[0 + v]) * 3;
+        const float* b = inPositions + size_t(inIndices[3 + v]) * 3;
+        const float* c = inPositions + size_t(inIndices[6 + v]) * 3;
+        const float* d = inPositions + size_t(inIndices[9 + v]) * 3;
+        p[v][0] = _mm_setr_ps(a[0], b[0], c[0], d[0]);
+        p[v][1] = _mm_setr_ps(a[1], b[1], c[1], d[1]);
+        p[v][2] = _mm_setr_ps(a[2], b[2], c[2], d[2]);
+    }
+    __m128 s0x = _mm_sub_ps(p[2][0], p[0][0]);
+    __m128 s0y = _mm_sub_ps(p[2][1], p[0][1]);
+    __m128 s0z = _mm_sub_ps(p[2][2], p[0][2]);
+    __m128 s1x = _mm_sub_ps(p[2][0], p[1][0]);
+    __m128 s1y = _mm_sub_ps(p[2][1], p[1][1]);
+    __m128 s1z = _mm_sub_ps(p[2][2], p[1][2]);
+
+    __m128 nx = _mm_sub_ps(_mm_mul_ps(s1y, s0z), _mm_mul_ps(s1z, s0y));
+    __m128 ny = _mm_sub_ps(_mm_mul_ps(s1z, s0x), _mm_mul_ps(s1x, s0z));
+    __m128 nz = _mm_sub_ps(_mm_mul_ps(s1x, s0y), _mm_mul_ps(s1y, s0x));
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 isZero = _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(nx, zero), _mm_cmpeq_ps(ny, zero)), _mm_cmpeq_ps(nz, zero));
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+    __m128 scale = _mm_blendv_ps(_mm_div_ps(_mm_set1_ps(1.0f), length), _mm_set1_ps(1.0f), isZero);
+
+    _mm_storeu_ps(outX, _mm_mul_ps(nx, scale));
+    _mm_storeu_ps(outY, _mm_mul_ps(ny, scale));
+    _mm_storeu_ps(outZ, _mm_mul_ps(nz, scale));
+}
+
+// SSE4.1 path, 8 triangles per step as 2 groups of 4
+VIM2DS_TARGET("sse4.1")
+static size_t AccumulateFaceNormalsSSE4(const cVec3* inPositions, const uint32_t* inIndices, size_t inTrianglesCount, cVec3* ioNormals) {
+    const float* positions = reinterpret_cast<const float*>(inPositions);
+    alignas(16) float nx[kTrianglesPerStep];
+    alignas(16) float ny[kTrianglesPerStep];
+    alignas(16) float nz[kTrianglesPerStep];
+    size_t t = 0;
+    for (; t + kTrianglesPerStep <= inTrianglesCount; t += kTrianglesPerStep, inIndices += 3 * kTrianglesPerStep) {
+        FaceNormalsSSE4(positions, inIndices, nx, ny, nz);
+        FaceNormalsSSE4(positions, inIndices + 12, nx + 4, ny + 4, nz + 4);
+        ScatterNormals(nx, ny, nz, inIndices, ioNormals);
+    }
+    return t;
+}
+
+// AVX2 path, 8 triangles per step.
+// Vertices are loaded with scalar inserts: vpgather isn't faster for 3 floats records and is very slow on microcode mitigated cpus.
+VIM2DS_TARGET("avx2")
+static size_t AccumulateFaceNormalsAVX2(const cVec3* inPositions, const uint32_t* inIndices, size_t inTrianglesCount, cVec3* ioNormals) {
+    const float* positions = reinterpret_cast<const float*>(inPositions);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    alignas(32) float nx[kTrianglesPerStep];
+    alignas(32) float ny[kTrianglesPerStep];
+    alignas(32) float nz[kTrianglesPerStep];
+    size_t t = 0;
+    for (; t + kTrianglesPerStep <= inTrianglesCount; t += kTrianglesPerStep, inIndices += 3 * kTrianglesPerStep) {
+        __m256 p[3][3];
+        for (int v = 0; v < 3; ++v) {
+            const float* a = positions + size_t(inIndices[0 + v]) * 3;
+            const float* b = positions + size_t(inIndices[3 + v]) * 3;
+            const float* c = positions + size_t(inIndices[6 + v]) * 3;
+            const float* d = positions + size_t(inIndices[9 + v]) * 3;
+            const float* e = positions + size_t(inIndices[12 + v]) * 3;
+            const float* f = positions + size_t(inIndices[15 + v]) * 3;
+            const float* g = positions + size_t(inIndices[18 + v]) * 3;
+            const float* h = positions + size_t(inIndices[21 + v]) * 3;
+            p[v][0] = _mm256_setr_ps(a[0], b[0], c[0], d[0], e[0], f[0], g[0], h[0]);
+            p[v][1] = _mm256_setr_ps(a[1], b[1], c[1], d[1], e[1], f[1], g[1], h[1]);
+            p[v][2] = _mm256_setr_ps(a[2], b[2], c[2], d[2], e[2], f[2], g[2], h[2]);
+        }
+        __m256 s0x = _mm256_sub_ps(p[2][0], p[0][0]);
+        __m256 s0y = _mm256_sub_ps(p[2][1], p[0][1]);
+        __m256 s0z = _mm256_sub_ps(p[2][2], p[0][2]);
+        __m256 s1x = _mm256_sub_ps(p[2][0], p[1][0]);
+        __m256 s1y = _mm256_sub_ps(p[2][1], p[1][1]);
+        __m256 s1z = _mm256_sub_ps(p[2][2], p[1][2]);
+
+        __m256 x = _mm256_sub_ps(_mm256_mul_ps(s1y, s0z), _mm256_mul_ps(s1z, s0y));
+        __m256 y = _mm256_sub_ps(_mm256_mul_ps(s1z, s0x), _mm256_mul_ps(s1x, s0z));
+        __m256 z = _mm256_sub_ps(_mm256_mul_ps(s1x, s0y), _mm256_mul_ps(s1y, s0x));
+
+        __m256 isZero = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_EQ_OQ), _mm256_cmp_ps(y, zero, _CMP_EQ_OQ)),
+                                      _mm256_cmp_ps(z, zero, _CMP_EQ_OQ));
+        __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+        __m256 scale = _mm256_blendv_ps(_mm256_div_ps(one, length), one, isZero);
+
+        _mm256_store_ps(nx, _mm256_mul_ps(x, scale));
+        _mm256_store_ps(ny, _mm256_mul_ps(y, scale));
+        _mm256_store_ps(nz, _mm256_mul_ps(z, scale));
+        ScatterNormals(nx, ny, nz, inIndices, ioNormals);
+    }
+    return t;
+}
+
+// Transform 4 points (12 floats, AoS) in place, inMatrix[i][r] is the matrix element (r, i) broadcasted
+VIM2DS_TARGET("sse4.1")
+static inline void TransformPointsSSE4(const __m128 inMatrix[3][4], float* ioPoints) {
+    // AoS to SoA: a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3
+    __m128 a = _mm_loadu_ps(ioPoints + 0);
+    __m128 b = _mm_loadu_ps(ioPoints + 4);
+    __m128 c = _mm_loadu_ps(ioPoints + 8);
+    __m128 xy23 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+    __m128 yz01 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+    __m128 x = _mm_shuffle_ps(a, xy23, _MM_SHUFFLE(2, 0, 3, 0));
+    __m128 y = _mm_shuffle_ps(yz01, xy23, _MM_SHUFFLE(3, 1, 2, 0));
+    __m128 z = _mm_shuffle_ps(yz01, c, _MM_SHUFFLE(3, 0, 3, 1));
+
+    // Same order as cVec4 dot product: ((m0 * x + m1 * y) + m2 * z) + m3 * 1
+    __m128 result[3];
+    for (int i = 0; i < 3; ++i)
+        result[i] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(inMatrix[i][0], x), _mm_mul_ps(inMatrix[i][1], y)), _mm_mul_ps(inMatrix[i][2], z)),
+                               inMatrix[i][3]);
+
+    // SoA to AoS
+    x = result[0];
+    y = result[1];
+    z = result[2];
+    __m128 xy01 = _mm_unpacklo_ps(x, y);
+    xy23 = _mm_unpackhi_ps(x, y);
+    __m128 zx01 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+    __m128 yz1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 zx23 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+    __m128 yz3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(ioPoints + 0, _mm_shuffle_ps(xy01, zx01, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(ioPoints + 4, _mm_shuffle_ps(yz1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(ioPoints + 8, _mm_shuffle_ps(zx23, yz3, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+// SSE4.1 path, 4 points per step
+VIM2DS_TARGET("sse4.1")
+static size_t TransformPointsSSE4(const cMat4& inTransform, cVec3* ioPoints, size_t inPointsCount) {
+    const float* rows[4] = {&inTransform.mRow0.x, &inTransform.mRow1.x, &inTransform.mRow2.x, &inTransform.mRow3.x};
+    __m128 m[3][4];
+    for (int i = 0; i < 3; ++i) {
+        for (int r = 0; r < 4; ++r)
+            m[i][r] = _mm_set1_ps(rows[r][i]);
+    }
+    float* points = reinterpret_cast<float*>(ioPoints);
+    size_t p = 0;
+    for (; p + 4 <= inPointsCount; p += 4)
+        TransformPointsSSE4(m, points + 3 * p);
+    return p;
+}
+
+// AVX2 path, 8 points per step: each 128 bits lane hold 4 points, shuffled like the SSE4 path
+VIM2DS_TARGET("avx2")
+static size_t TransformPointsAVX2(const cMat4& inTransform, cVec3* ioPoints, size_t inPointsCount) {
+    const float* rows[4] = {&inTransform.mRow0.x, &inTransform.mRow1.x, &inTransform.mRow2.x, &inTransform.mRow3.x};
+    __m256 m[3][4];
+    for (int i = 0; i < 3; ++i) {
+        for (int r = 0; r < 4; ++r)
+            m[i][r] = _mm256_set1_ps(rows[r][i]);
+    }
+    float* points = reinterpret_cast<float*>(ioPoints);
+    size_t p = 0;
+    for (; p + 8 <= inPointsCount; p += 8) {
+        float* step = points + 3 * p;
+        __m256 in0 = _mm256_loadu_ps(step + 0);
+        __m256 in1 = _mm256_loadu_ps(step + 8);
+        __m256 in2 = _mm256_loadu_ps(step + 16);
+        __m256 a = _mm256_permute2f128_ps(in0, in1, 0x30);
+        __m256 b = _mm256_permute2f128_ps(in0, in2, 0x21);
+        __m256 c = _mm256_permute2f128_ps(in1, in2, 0x30);
+
+        __m256 xy23 = _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+        __m256 yz01 = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+        __m256 x = _mm256_shuffle_ps(a, xy23, _MM_SHUFFLE(2, 0, 3, 0));
+        __m256 y = _mm256_shuffle_ps(yz01, xy23, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 z = _mm256_shuffle_ps(yz01, c, _MM_SHUFFLE(3, 0, 3, 1));
+
+        __m256 result[3];
+        for (int i = 0; i < 3; ++i)
+            result[i] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[i][0], x), _mm256_mul_ps(m[i][1], y)), _mm256_mul_ps(m[i][2], z)),
+                                      m[i][3]);
+
+        x = result[0];
+        y = result[1];
+        z = result[2];
+        __m256 xy01 = _mm256_unpacklo_ps(x, y);
+        xy23 = _mm256_unpackhi_ps(x, y);
+        __m256 zx01 = _mm256_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+        __m256 yz1 = _mm256_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+        __m256 zx23 = _mm256_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+        __m256 yz3 = _mm256_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm256_shuffle_ps(xy01, zx01, _MM_SHUFFLE(2, 0, 1, 0));
+        b = _mm256_shuffle_ps(yz1, xy23, _MM_SHUFFLE(1, 0, 2, 0));
+        c = _mm256_shuffle_ps(zx23, yz3, _MM_SHUFFLE(2, 0, 2, 0));
+        _mm256_storeu_ps(step + 0, _mm256_permute2f128_ps(a, b, 0x20));
+        _mm256_storeu_ps(step + 8, _mm256_permute2f128_ps(c, a, 0x30));
+        _mm256_storeu_ps(step + 16, _mm256_permute2f128_ps(b, c, 0x31));
+    }
+    return p;
+}
+
+#endif
+
+// Subtract the normalized face normal of each triangle to the normals of it's 3 vertices.
+void AccumulateFaceNormals(const cVec3* inPositions, const uint32_t* inIndices, size_t inTrianglesCount, cVec3* ioNormals) {
+    size_t done = 0;
+#if VIM2DS_USE_X86_SIMD
+    switch (GetSimdLevel()) {
+        case kSimdAVX2:
+            done = AccumulateFaceNormalsAVX2(inPositions, inIndices, inTrianglesCount, ioNormals);
+            break;
+        case kSimdSSE4:
+            done = AccumulateFaceNormalsSSE4(inPositions, inIndices, inTrianglesCount, ioNormals);
+            break;
+        case kSimdScalar:
+            break;
+    }
+#endif
+    // Remaining triangles (or all when no simd)
+    AccumulateFaceNormalsScalar(inPositions, inIndices + 3 * done, inTrianglesCount - done, ioNormals);
+}
+
+// Transform the points in place (point * inTransform, as cVec3 * cMat4)
+void TransformPoints(const cMat4& inTransform, cVec3* ioPoints, size_t inPointsCount) {
+    size_t done = 0;
+#if VIM2DS_USE_X86_SIMD
+    switch (GetSimdLevel()) {
+        case kSimdAVX2:
+            done = TransformPointsAVX2(inTransform, ioPoints, inPointsCount);
+            break;
+        case kSimdSSE4:
+            done = TransformPointsSSE4(inTransform, ioPoints, inPointsCount);
+            break;
+        case kSimdScalar:
+            break;
+    }
+#endif
+    // Remaining points (or all when no simd)
+    for (size_t p = done; p < inPointsCount; ++p)
+        ioPoints[p] = ioPoints[p] * inTransform;
+}
+
+} // namespace Vim2Ds
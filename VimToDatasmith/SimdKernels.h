@@ -0,0 +1,33 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#pragma once
+
+#include "VimToDatasmith.h"
+
+class cVec3;
+class cMat4;
+
+namespace Vim2Ds {
+
+// Instruction sets the kernels can use, ordered by capability
+enum ESimdLevel : uint32_t { kSimdScalar, kSimdSSE4, kSimdAVX2 };
+
+// Best instruction set supported by the processor and the OS (detected once)
+ESimdLevel GetSimdLevel();
+
+// Restrict the kernels to inLevel (capped to the supported level), mostly to compare the paths
+void SetSimdLevel(ESimdLevel inLevel);
+
+// Name of the level, for traces
+const utf8_t* GetSimdLevelName(ESimdLevel inLevel);
+
+// Subtract the normalized face normal of each triangle to the normals of it's 3 vertices.
+// Give the exact same result as the cVec3 ^ and Normalise code, whatever the level used.
+void AccumulateFaceNormals(const cVec3* inPositions, const uint32_t* inIndices, size_t inTrianglesCount, cVec3* ioNormals);
+
+// Transform the points in place (point * inTransform, as cVec3 * cMat4: rows 0 to 2 are the 3x3 part, row 3 the translation).
+// Give the exact same result as the cVec4 * cMat4 code, whatever the level used.
+void TransformPoints(const cMat4& inTransform, cVec3* ioPoints, size_t inPointsCount);
+
+} // namespace Vim2Ds
@@ -0,0 +1,202 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#include "SystemResources.h"
+#include "DebugTools.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if macOS
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#endif
+#if winOS
+#include <windows.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace Vim2Ds {
+
+#if defined(__linux__)
+
+// Get the cgroup v2 mount point and the folder of the process group (return false if cgroup v2 isn't mounted)
+static bool GetCGroupFolder(utf8_string* outMountPoint, utf8_string* outFolder) {
+    // Mount point of the cgroup2 file system (/sys/fs/cgroup, or /sys/fs/cgroup/unified on hybrid hierarchies) and the
+    // hierarchy folder mounted there (not "/" when a container mount only it's own group)
+    utf8_string mountRoot;
+    utf8_string mountPoint;
+    std::ifstream mountInfo("/proc/self/mountinfo");
+    utf8_string line;
+    while (mountPoint.empty() && std::getline(mountInfo, line)) {
+        size_t separator = line.find(" - ");
+        if (separator != utf8_string::npos && line.compare(separator + 3, 8, "cgroup2 ") == 0) {
+            std::istringstream fields(line);
+            utf8_string field;
+            for (int i = 0; i < 5 && fields >> field; ++i) {
+                if (i == 3)
+                    mountRoot = field;
+            }
+            mountPoint = field;
+        }
+    }
+    if (mountPoint.empty())
+        return false;
+    if (mountRoot == "/")
+        mountRoot.clear();
+
+    // Our group in the hierarchy, relative to the mount root
+    std::ifstream cgroup("/proc/self/cgroup");
+    while (std::getline(cgroup, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            utf8_string group(line.substr(3));
+            if (group.compare(0, mountRoot.size(), mountRoot) != 0 ||
+                (group.size() > mountRoot.size() && group[mountRoot.size()] != '/')) {
+                TraceF("GetCGroupFolder - Group %s isn't under the mount root %s\n", group.c_str(), mountRoot.c_str());
+                return false;
+            }
+            *outMountPoint = mountPoint;
+            *outFolder = mountPoint + group.substr(mountRoot.size());
+            while (outFolder->size() > mountPoint.size() && outFolder->back() == '/')
+                outFolder->pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Call inFunctor(folder) for the process cgroup and it's parents (each level may limit it's children)
+template <class Functor> static void ForEachCGroup(const Functor& inFunctor) {
+    utf8_string mountPoint;
+    utf8_string folder;
+    if (!GetCGroupFolder(&mountPoint, &folder))
+        return;
+    for (;;) {
+        inFunctor(folder);
+        if (folder.size() <= mountPoint.size())
+            break;
+        folder.erase(std::max(folder.find_last_of('/'), mountPoint.size()));
+    }
+}
+
+// Read the first line of the file (return false if it can't be read)
+static bool ReadFirstLine(const utf8_string& inFileName, utf8_string* outLine) {
+    std::ifstream file(inFileName);
+    return bool(std::getline(file, *outLine));
+}
+
+#endif
+
+// Processors the process may use
+unsigned GetAvailableProcessors() {
+    unsigned processors = std::thread::hardware_concurrency();
+    if (processors == 0)
+        processors = 1;
+
+#if defined(__linux__)
+    // The affinity mask reflect the cpuset
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0 && CPU_COUNT(&affinity) > 0)
+        processors = std::min(processors, unsigned(CPU_COUNT(&affinity)));
+
+    // cpu.max is "$MAX $PERIOD", $MAX being "max" when there's no quota. Partial processors are dropped, since a
+    // thread more than the quota get the whole process throttled
+    ForEachCGroup([&processors](const utf8_string& inFolder) {
+        utf8_string cpuMax;
+        if (ReadFirstLine(inFolder + "/cpu.max", &cpuMax)) {
+            unsigned long long quota = 0;
+            unsigned long long period = 0;
+            if (sscanf(cpuMax.c_str(), "%llu %llu", &quota, &period) == 2 && quota != 0 && period != 0) {
+                unsigned quotaProcessors = unsigned(std::max(1ull, quota / period));
+                TraceF("GetAvailableProcessors - %s/cpu.max = %s (%u processors)\n", inFolder.c_str(), cpuMax.c_str(), quotaProcessors);
+                processors = std::min(processors, quotaProcessors);
+            }
+        }
+    });
+#endif
+
+    return processors;
+}
+
+// Memory the process may use in bytes
+uint64_t GetAvailableMemory() {
+    uint64_t memory = 0;
+#if defined(__linux__)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0)
+        memory = uint64_t(pages) * uint64_t(pageSize);
+
+    // memory.max is "max" when there's no limit
+    ForEachCGroup([&memory](const utf8_string& inFolder) {
+        utf8_string memoryMax;
+        if (ReadFirstLine(inFolder + "/memory.max", &memoryMax)) {
+            unsigned long long limit = 0;
+            if (sscanf(memoryMax.c_str(), "%llu", &limit) == 1 && limit != 0) {
+                TraceF("GetAvailableMemory - %s/memory.max = %llu\n", inFolder.c_str(), limit);
+                memory = memory == 0 ? uint64_t(limit) : std::min(memory, uint64_t(limit));
+            }
+        }
+    });
+#elif macOS
+    uint64_t memSize = 0;
+    size_t length = sizeof(memSize);
+    if (sysctlbyname("hw.memsize", &memSize, &length, nullptr, 0) == 0)
+        memory = memSize;
+#elif winOS
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        memory = status.ullTotalPhys;
+#endif
+    return memory;
+}
+
+// Pin the current thread on the inIndex'th processor it may use
+bool PinCurrentThread(unsigned inIndex) {
+#if defined(__linux__)
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity) != 0 || CPU_COUNT(&affinity) == 0)
+        return false;
+    unsigned index = inIndex % unsigned(CPU_COUNT(&affinity));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &affinity) && index-- == 0) {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(cpu, &pinned);
+            return pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) == 0;
+        }
+    }
+    return false;
+#elif winOS
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) || processMask == 0)
+        return false;
+    unsigned count = 0;
+    for (DWORD_PTR mask = processMask; mask != 0; mask &= mask - 1)
+        ++count;
+    unsigned index = inIndex % count;
+    for (unsigned bit = 0; bit < sizeof(DWORD_PTR) * 8; ++bit) {
+        DWORD_PTR cpu = DWORD_PTR(1) << bit;
+        if ((processMask & cpu) != 0 && index-- == 0)
+            return SetThreadAffinityMask(GetCurrentThread(), cpu) != 0;
+    }
+    return false;
+#else
+    // macOS doesn't let us choose the processor of a thread
+    (void)inIndex;
+    return false;
+#endif
+}
+
+} // namespace Vim2Ds
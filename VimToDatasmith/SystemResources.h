@@ -0,0 +1,20 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#pragma once
+
+#include "VimToDatasmith.h"
+
+namespace Vim2Ds {
+
+// Processors the process may use: the hardware threads, limited by the affinity mask (cpuset) and the cgroup v2
+// cpu.max quota (containers report the host processors count)
+unsigned GetAvailableProcessors();
+
+// Memory the process may use in bytes: the cgroup v2 memory.max limit, otherwise the physical memory (0 if unknown)
+uint64_t GetAvailableMemory();
+
+// Pin the current thread on the inIndex'th processor it may use (return false if not supported)
+bool PinCurrentThread(unsigned inIndex);
+
+} // namespace Vim2Ds
@@ -60,24 +60,25 @@ template <class C, class Indexor = std::size_t> class TAttributeVector : public
     void Initialize(const g3d::Attribute& inAttr) {
         size_t dataSize = inAttr.byte_size();
         this->mCount = dataSize / sizeof(C);
-        TestAssert(dataSize == this->mCount * sizeof(C));
+        TestAssert(dataSize == this->mCount * sizeof(C) && reinterpret_cast<uintptr_t>(inAttr._begin) % alignof(C) == 0);
         this->mData = reinterpret_cast<C*>(inAttr._begin);
     }
 };
 
-// Vector class that refers to vector of integer.
-/* Doesn't copy the vector */
+// Vector class that refers to an entity table column of integer.
+/* Doesn't copy the column */
 template <class C, class Indexor> class TIndexor : public TVector<C, Indexor> {
     static_assert(sizeof(C) == sizeof(int), "C hasn't same size as int");
 
   public:
     TIndexor() {}
-    TIndexor(const std::vector<int>& inOriginal) { Initialize(inOriginal); }
+    template <class T> TIndexor(const Vim::ColumnView<T>& inOriginal) { Initialize(inOriginal); }
 
-    void Initialize(const std::vector<int>& inOriginal) {
+    template <class T> void Initialize(const Vim::ColumnView<T>& inOriginal) {
+        static_assert(sizeof(T) == sizeof(int), "T hasn't same size as int");
         this->mCount = inOriginal.size();
         if (this->mCount > 0)
-            this->mData = const_cast<C*>(reinterpret_cast<const C*>(&inOriginal[0]));
+            this->mData = const_cast<C*>(reinterpret_cast<const C*>(inOriginal.data()));
     }
 };
 
@@ -0,0 +1,139 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#include "Utf8Transcoder.h"
+
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define VIM2DS_USE_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace Vim2Ds {
+
+static const char32_t kReplacementChar = '?';
+
+// Index of the lowest bit set (inMask must not be 0)
+static inline unsigned LowestBit(unsigned inMask) {
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanForward(&bit, inMask);
+    return unsigned(bit);
+#else
+    return unsigned(__builtin_ctz(inMask));
+#endif
+}
+
+// Decode one non ascii code point, advance ioUtf8 (return kReplacementChar for invalid sequence)
+static inline char32_t DecodeCodePoint(const uint8_t*& ioUtf8, const uint8_t* inEnd) {
+    const uint8_t* s = ioUtf8;
+    uint8_t lead = *s;
+    size_t available = size_t(inEnd - s);
+    auto isContinuation = [](uint8_t c) { return (c & 0xC0) == 0x80; };
+
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        if (available >= 2 && isContinuation(s[1])) {
+            ioUtf8 += 2;
+            return char32_t(((lead & 0x1F) << 6) | (s[1] & 0x3F));
+        }
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        if (available >= 3 && isContinuation(s[1]) && isContinuation(s[2])) {
+            // Reject overlong encodings and surrogates
+            if ((lead != 0xE0 || s[1] >= 0xA0) && (lead != 0xED || s[1] < 0xA0)) {
+                ioUtf8 += 3;
+                return char32_t(((lead & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F));
+            }
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        if (available >= 4 && isContinuation(s[1]) && isContinuation(s[2]) && isContinuation(s[3])) {
+            // Reject overlong encodings and code points above 0x10FFFF
+            if ((lead != 0xF0 || s[1] >= 0x90) && (lead != 0xF4 || s[1] < 0x90)) {
+                ioUtf8 += 4;
+                return char32_t(((lead & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F));
+            }
+        }
+    }
+    ++ioUtf8;
+    return kReplacementChar;
+}
+
+// Write the code point, return the number of units written
+static inline size_t Encode(char32_t inCodePoint, char16_t* outUtf16) {
+    if (inCodePoint < 0x10000) {
+        *outUtf16 = char16_t(inCodePoint);
+        return 1;
+    }
+    inCodePoint -= 0x10000;
+    outUtf16[0] = char16_t(0xD800 + (inCodePoint >> 10));
+    outUtf16[1] = char16_t(0xDC00 + (inCodePoint & 0x3FF));
+    return 2;
+}
+
+static inline size_t Encode(char32_t inCodePoint, char32_t* outUtf32) {
+    *outUtf32 = inCodePoint;
+    return 1;
+}
+
+#if VIM2DS_USE_SSE2
+// Widen 16 ascii bytes
+static inline void WidenAscii(__m128i inBytes, char16_t* outUtf16) {
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128((__m128i*)outUtf16, _mm_unpacklo_epi8(inBytes, zero));
+    _mm_storeu_si128((__m128i*)(outUtf16 + 8), _mm_unpackhi_epi8(inBytes, zero));
+}
+
+static inline void WidenAscii(__m128i inBytes, char32_t* outUtf32) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_unpacklo_epi8(inBytes, zero);
+    __m128i high = _mm_unpackhi_epi8(inBytes, zero);
+    _mm_storeu_si128((__m128i*)outUtf32, _mm_unpacklo_epi16(low, zero));
+    _mm_storeu_si128((__m128i*)(outUtf32 + 4), _mm_unpackhi_epi16(low, zero));
+    _mm_storeu_si128((__m128i*)(outUtf32 + 8), _mm_unpacklo_epi16(high, zero));
+    _mm_storeu_si128((__m128i*)(outUtf32 + 12), _mm_unpackhi_epi16(high, zero));
+}
+#endif
+
+// Ascii runs are widened 16 bytes at a time, other code points are decoded one by one
+template <class Unit> static size_t Utf8ToUnits(const utf8_t* inUtf8, size_t inLength, Unit* outUnits) {
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(inUtf8);
+    const uint8_t* end = s + inLength;
+    Unit* out = outUnits;
+    while (s < end) {
+#if VIM2DS_USE_SSE2
+        if (end - s >= 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)s);
+            unsigned nonAscii = unsigned(_mm_movemask_epi8(bytes));
+            if (nonAscii == 0) {
+                WidenAscii(bytes, out);
+                s += 16;
+                out += 16;
+                continue;
+            }
+            // Copy the ascii bytes before the first non ascii one
+            for (unsigned asciiCount = LowestBit(nonAscii); asciiCount != 0; --asciiCount)
+                *out++ = Unit(*s++);
+        }
+#endif
+        if (*s < 0x80)
+            *out++ = Unit(*s++);
+        else
+            out += Encode(DecodeCodePoint(s, end), out);
+    }
+    return size_t(out - outUnits);
+}
+
+// Convert utf8 to utf16 (surrogate pairs above 0xFFFF), return the number of char16_t written.
+size_t Utf8ToUtf16(const utf8_t* inUtf8, size_t inLength, char16_t* outUtf16) {
+    return Utf8ToUnits(inUtf8, inLength, outUtf16);
+}
+
+// Convert utf8 to utf32, return the number of char32_t written.
+size_t Utf8ToUtf32(const utf8_t* inUtf8, size_t inLength, char32_t* outUtf32) {
+    return Utf8ToUnits(inUtf8, inLength, outUtf32);
+}
+
+} // namespace Vim2Ds
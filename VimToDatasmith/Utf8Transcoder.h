@@ -0,0 +1,34 @@
+// Copyright (c) 2021 VIM
+// Licensed under the MIT License 1.0
+
+#pragma once
+
+#include "VimToDatasmith.h"
+
+#include <type_traits>
+
+namespace Vim2Ds {
+
+// Convert utf8 to utf16 (surrogate pairs above 0xFFFF), return the number of char16_t written.
+// outUtf16 must have room for inLength char16_t. Invalid sequences are replaced by '?'
+size_t Utf8ToUtf16(const utf8_t* inUtf8, size_t inLength, char16_t* outUtf16);
+
+// Convert utf8 to utf32, return the number of char32_t written.
+// outUtf32 must have room for inLength char32_t. Invalid sequences are replaced by '?'
+size_t Utf8ToUtf32(const utf8_t* inUtf8, size_t inLength, char32_t* outUtf32);
+
+template <class WideChar> size_t Utf8ToWide(const utf8_t* inUtf8, size_t inLength, WideChar* outWide, std::integral_constant<size_t, 2>) {
+    return Utf8ToUtf16(inUtf8, inLength, reinterpret_cast<char16_t*>(outWide));
+}
+
+template <class WideChar> size_t Utf8ToWide(const utf8_t* inUtf8, size_t inLength, WideChar* outWide, std::integral_constant<size_t, 4>) {
+    return Utf8ToUtf32(inUtf8, inLength, reinterpret_cast<char32_t*>(outWide));
+}
+
+// Convert utf8 to a wide character type (TCHAR, wchar_t...), utf16 or utf32 depending of it's size
+template <class WideChar> size_t Utf8ToWide(const utf8_t* inUtf8, size_t inLength, WideChar* outWide) {
+    static_assert(sizeof(WideChar) == sizeof(char16_t) || sizeof(WideChar) == sizeof(char32_t), "Unsupported wide character size");
+    return Utf8ToWide(inUtf8, inLength, outWide, std::integral_constant<size_t, sizeof(WideChar)>());
+}
+
+} // namespace Vim2Ds
@@ -30,17 +30,17 @@ bool CreateDirectoryW(wchar_t* lpPathName, void* lpSecurityAttributes);
 
 namespace Vim2Ds {
 
-// Simple function to create a folder
+// Simple function to create a folder (an other thread may create it concurrently)
 bool CreateFolder(const utf8_t* inFolderName) {
     struct stat st = {0};
     if (stat(inFolderName, &st) == -1) {
 #if winOS
-        if (CreateDirectoryW(UTF8_TO_TCHAR(inFolderName), nullptr) != true) {
+        if (CreateDirectoryW(UTF8_TO_TCHAR(inFolderName), nullptr) != true && GetLastError() != ERROR_ALREADY_EXISTS) {
             DebugF("CreateFolder - Can't create folder: \"%s\" error=%d\n", inFolderName, errno);
             return false;
         }
 #else
-        if (mkdir(inFolderName, S_IRWXU | S_IRWXG | S_IRWXO) != 0) {
+        if (mkdir(inFolderName, S_IRWXU | S_IRWXG | S_IRWXO) != 0 && errno != EEXIST) {
             DebugF("CreateFolder - Can't create folder: \"%s\" error=%d\n", inFolderName, errno);
             return false;
         }
@@ -50,7 +50,10 @@ bool CreateFolder(const utf8_t* inFolderName) {
 }
 
 void Usage() {
-    DebugF("Usage: VimToDatasmith [-NoHierarchicalInstance] VimFilePath.vim [DatasmithFilePath.udatasmith]");
+    DebugF("Usage: VimToDatasmith [-NoHierarchicalInstance] [-Threads=N] [-MemoryMB=N] [-PinThreads] VimFilePath.vim [DatasmithFilePath.udatasmith]\n");
+    DebugF("\t-Threads=N (or VIM2DS_THREADS): workers count (1 to 1024), default is the processors available (container quota included)\n");
+    DebugF("\t-MemoryMB=N (or VIM2DS_MEMORY_MB): memory budget, default is the memory available (container limit included)\n");
+    DebugF("\t-PinThreads: pin each worker on it's own processor\n");
     exit(EXIT_FAILURE);
 }
 
@@ -17,6 +17,22 @@
 #include <algorithm>
 #include <iterator>
 #include <stdexcept>
+#include <memory>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace bfast
 {
@@ -77,7 +93,148 @@ namespace bfast
         const byte* begin() const { return _begin; }
         const byte* end() const { return _end; }
         const size_t size() const { return end() - begin(); }
-        const string to_string() { return string(begin(), end()); }
+        string to_string() const { return string(begin(), end()); }
+    };
+
+    // Access pattern hints given to the OS for a mapped file
+    enum class Advice
+    {
+        normal,
+        sequential,
+        random,
+        willneed,
+    };
+
+    // A file mapped in memory. The mapping is private (copy-on-write): the pages stay backed by the file, so they
+    // are shared with the page cache and can be dropped under memory pressure. A reader may still patch data in place,
+    // only the touched pages are then duplicated.
+    class MappedFile
+    {
+    public:
+        // Returns nullptr when the file can't be mapped (empty file, file system without mapping support, ...)
+        static shared_ptr<MappedFile> open(const string& file)
+        {
+            shared_ptr<MappedFile> r(new MappedFile());
+            if (!r->map(file))
+                return nullptr;
+            return r;
+        }
+
+        ~MappedFile() { unmap(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ByteRange range() const { return ByteRange{ _begin, _begin + _size }; }
+
+        // Gives the OS a hint on how the whole mapping will be accessed
+        void advise(Advice advice) const { advise(range(), advice); }
+
+        // Gives the OS a hint on how a part of the mapping will be accessed (ignored on Windows)
+        void advise(const ByteRange& r, Advice advice) const
+        {
+#ifndef _WIN32
+            if (r.size() == 0 || r.begin() < _begin || r.end() > _begin + _size)
+                return;
+            static const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+            auto begin = (uintptr_t)r.begin() & ~(uintptr_t)(page_size - 1);
+            auto end = (uintptr_t)r.end();
+            int posix_advice = MADV_NORMAL;
+            switch (advice) {
+                case Advice::sequential:    posix_advice = MADV_SEQUENTIAL; break;
+                case Advice::random:        posix_advice = MADV_RANDOM; break;
+                case Advice::willneed:      posix_advice = MADV_WILLNEED; break;
+                default:                    break;
+            }
+            madvise((void*)begin, end - begin, posix_advice);
+#else
+            (void)r;
+            (void)advice;
+#endif
+        }
+
+    private:
+        MappedFile() {}
+
+#ifdef _WIN32
+        bool map(const string& file)
+        {
+            // Vim2Ds file names are utf8 encoded
+            int length = MultiByteToWideChar(CP_UTF8, 0, file.c_str(), -1, nullptr, 0);
+            if (length <= 0)
+                return false;
+            std::wstring wfile(length, L'\0');
+            MultiByteToWideChar(CP_UTF8, 0, file.c_str(), -1, &wfile[0], length);
+
+            _file = CreateFileW(wfile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (_file == INVALID_HANDLE_VALUE)
+                return false;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+                return false;
+            _mapping = CreateFileMappingW(_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if (_mapping == nullptr)
+                return false;
+            _begin = (byte*)MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+            if (_begin == nullptr)
+                return false;
+            _size = (size_t)size.QuadPart;
+            return true;
+        }
+
+        void unmap()
+        {
+            if (_begin != nullptr)
+                UnmapViewOfFile(_begin);
+            if (_mapping != nullptr)
+                CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE)
+                CloseHandle(_file);
+            _begin = nullptr;
+            _mapping = nullptr;
+            _file = INVALID_HANDLE_VALUE;
+        }
+
+        HANDLE _file = INVALID_HANDLE_VALUE;
+        HANDLE _mapping = nullptr;
+#else
+        bool map(const string& file)
+        {
+            int fd = ::open(file.c_str(), O_RDONLY);
+            if (fd == -1)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                return false;
+            }
+            // The descriptor isn't needed once the mapping exists
+            void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                return false;
+            _begin = (byte*)addr;
+            _size = (size_t)st.st_size;
+            return true;
+        }
+
+        void unmap()
+        {
+            if (_begin != nullptr)
+                munmap(_begin, _size);
+            _begin = nullptr;
+        }
+#endif
+
+        byte* _begin = nullptr;
+        size_t _size = 0;
+    };
+
+    // How Bfast::read_file gets the file content
+    enum class ReadMode
+    {
+        buffered,   // The file is copied in a memory buffer
+        mapped,     // The file is mapped in memory (fallback to buffered if mapping isn't possible)
     };
 
     // A Bfast buffer conceptually is a name and a byte-range
@@ -236,8 +393,21 @@ namespace bfast
         vector<byte> name_data;
         ByteRange data;
         vector<byte> dataBuffer;
+        shared_ptr<MappedFile> mapping;
         vector<Buffer> buffers;
 
+        // Gives the OS a hint on how the data will be accessed (no effect if the data isn't mapped)
+        void advise(Advice advice) const {
+            if (mapping)
+                mapping->advise(data, advice);
+        }
+
+        // Gives the OS a hint on how a buffer's data will be accessed (no effect if the data isn't mapped)
+        void advise(const ByteRange& range, Advice advice) const {
+            if (mapping)
+                mapping->advise(range, advice);
+        }
+
         // Construct a raw BFast data block, using the names string argument to store the names data. 
         RawData to_raw_data() {
             // Compute the name data
@@ -336,16 +506,32 @@ namespace bfast
             Bfast r;
             r.dataBuffer = move(data);
             r.data = ByteRange{ r.dataBuffer.data(), r.dataBuffer.data() + r.dataBuffer.size() };
-            auto raw_data = RawData::unpack(r.data);
+            r.unpack_buffers();
+            return r;
+        }
+
+        // Unpacks a mapped file, buffers point directly in the mapping
+        static Bfast unpack(const shared_ptr<MappedFile>& mapping)
+        {
+            Bfast r;
+            r.mapping = mapping;
+            r.data = mapping->range();
+            r.unpack_buffers();
+            return r;
+        }
+
+        // Fills the buffers from data
+        void unpack_buffers()
+        {
+            auto raw_data = RawData::unpack(data);
             auto names = split_names(raw_data.ranges[0]);
             if (names.size() != raw_data.ranges.size() - 1)
                 throw std::runtime_error("The number of names does not match the raw data size");
-            r.buffers.resize(names.size());
+            buffers.resize(names.size());
             for (size_t i = 0; i < names.size(); ++i)
             {
-                r.buffers[i] = Buffer{ names[i], raw_data.ranges[i + 1] };
+                buffers[i] = Buffer{ names[i], raw_data.ranges[i + 1] };
             }
-            return r;
         }
 
         void write_file(string file) {
@@ -366,7 +552,13 @@ namespace bfast
             fclose(f);
         }
 
-        static Bfast read_file(string file) {
+        static Bfast read_file(string file, ReadMode mode = ReadMode::mapped) {
+            if (mode == ReadMode::mapped) {
+                auto mapping = MappedFile::open(file);
+                if (mapping)
+                    return Bfast::unpack(mapping);
+            }
+
             std::ifstream fstrm(file, ios_base::in | ios_base::binary);
             fstrm.seekg(0, ios_base::end);
             auto filesize = fstrm.tellg();
@@ -11,6 +11,7 @@
 #include <vector>
 #include <sstream>
 #include <map>
+#include <array>
 
 #include "bfast.h"
 
@@ -48,6 +49,55 @@ namespace g3d
         assoc_none,
     };
 
+    /// Attributes with a known layout, bound in O(1) with their descriptor hash
+    enum class KnownAttribute
+    {
+        position,
+        index,
+        vertex_uv,
+        vertex_normal,
+        vertex_color_with_alpha,
+        face_material_id,
+        face_group,
+        subgeometry_index_offset,
+        subgeometry_vertex_offset,
+        instance_transform,
+        instance_parent,
+        instance_subgeometry,
+        count,
+        unknown = count
+    };
+
+    /// Hash of a descriptor string (FNV-1a 64 bits), usable at compile time
+    constexpr uint64_t descriptor_hash(const char* s, uint64_t h = 14695981039346656037ull)
+    {
+        return *s == 0 ? h : descriptor_hash(s + 1, (h ^ uint64_t(uint8_t(*s))) * 1099511628211ull);
+    }
+
+    /// Same hash for a runtime string
+    inline uint64_t descriptor_hash(const string& s)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : s)
+            h = (h ^ uint64_t(uint8_t(c))) * 1099511628211ull;
+        return h;
+    }
+
+    /// Layout of a known attribute
+    struct KnownDescriptor
+    {
+        const char* name;
+        KnownAttribute known;
+        Association association;
+        const char* semantic;
+        int index;
+        DataType data_type;
+        int data_arity;
+    };
+
+    /// Returns the known descriptor of this descriptor string, nullptr if it isn't known
+    inline const KnownDescriptor* find_known_descriptor(const string& name);
+
     // Contains all the information necessary to parse an attribute data channel and associate it with some part of the geometry 
     struct AttributeDescriptor
     {
@@ -194,12 +244,26 @@ namespace g3d
     /// Manage the data buffer and meta-information of an attribute 
     struct Attribute {
         Attribute(const string& desc, const void* begin, const void* end)
-            : descriptor(AttributeDescriptor::from_string(desc))
-            , _begin((uint8_t*)begin)
+            : _begin((uint8_t*)begin)
             , _end((uint8_t*)end)
         { 
             if (!begin || !end) throw runtime_error("Null parameters");
-            if (byte_size() % data_element_size() != 0) throw runtime_error("Data buffer byte size does not divide evenly by size of elements");        
+
+            // Known attributes don't need to be parsed (alignment is checked by data_as, where typed access need it)
+            const KnownDescriptor* knownDescriptor = find_known_descriptor(desc);
+            if (knownDescriptor != nullptr)
+            {
+                known = knownDescriptor->known;
+                descriptor.data_type = knownDescriptor->data_type;
+                descriptor.data_arity = knownDescriptor->data_arity;
+                descriptor.index = knownDescriptor->index;
+                descriptor.association = knownDescriptor->association;
+                descriptor.semantic = knownDescriptor->semantic;
+            }
+            else
+                descriptor = AttributeDescriptor::from_string(desc);
+            // Normals can be computed, so a malformed normals attribute is left to the user to reject
+            if (byte_size() % data_element_size() != 0 && known != KnownAttribute::vertex_normal) throw runtime_error("Data buffer byte size does not divide evenly by size of elements");        
         }
         size_t byte_size() const {
             return _end - _begin;
@@ -216,7 +280,15 @@ namespace g3d
         static Attribute from_buffer(bfast::Buffer buffer) {
             return Attribute(buffer.name, buffer.data.begin(), buffer.data.end());
         }
+        /// Returns the data as an array of T (T must have the size of an element and the data must be aligned for T)
+        template<typename T>
+        const T* data_as() const {
+            if (sizeof(T) != data_element_size()) throw runtime_error("Type size does not match the size of elements");
+            if ((uintptr_t)_begin % alignof(T) != 0) throw runtime_error("Data buffer isn't aligned for the type");
+            return (const T*)_begin;
+        }
         AttributeDescriptor descriptor;
+        KnownAttribute known = KnownAttribute::unknown;
         uint8_t* _begin;
         uint8_t* _end;
     };
@@ -230,15 +302,18 @@ namespace g3d
 
         G3d()
             : meta(default_meta())
-        { }
+        {
+            known_attributes.fill(-1);
+        }
 
-        G3d(bfast::Bfast& inputBfast)
+        /// Attributes refer to the buffers of inputBfast (nothing is copied), inputBfast must outlive this G3d
+        G3d(const bfast::Bfast& inputBfast)
         {
-            attributes.clear();
-            bfast = inputBfast;
-            for (auto i = 0; i < bfast.buffers.size(); ++i)
+            known_attributes.fill(-1);
+            attributes.reserve(inputBfast.buffers.size());
+            for (size_t i = 0; i < inputBfast.buffers.size(); ++i)
             {
-                auto b = bfast.buffers[i];
+                const auto& b = inputBfast.buffers[i];
                 if (i == 0)
                     meta = b.data.to_string();
                 else
@@ -247,6 +322,15 @@ namespace g3d
                 }
             }
         }
+
+        /// Returns the attribute with this known semantic, nullptr if the geometry hasn't it
+        const Attribute* find_attribute(KnownAttribute known) const
+        {
+            if (known >= KnownAttribute::count)
+                return nullptr;
+            int index = known_attributes[size_t(known)];
+            return index >= 0 ? &attributes[index] : nullptr;
+        }
             
         static string default_meta() {
             return "{ \"G3D\": \"1.0.0\" }";
@@ -268,10 +352,11 @@ namespace g3d
         void read_file(string path)
         {
             attributes.clear();
+            known_attributes.fill(-1);
             bfast = bfast::Bfast::read_file(path);
-            for (auto i = 0; i < bfast.buffers.size(); ++i)
+            for (size_t i = 0; i < bfast.buffers.size(); ++i)
             {
-                auto b = bfast.buffers[i];
+                const auto& b = bfast.buffers[i];
                 if (i == 0)
                     meta = b.data.to_string();
                 else
@@ -281,11 +366,19 @@ namespace g3d
 
         void add_attribute(const string& name, const void* begin, const void* end) {
             attributes.push_back(Attribute(name, begin, end));
+            // The first attribute of a known semantic is the one found
+            KnownAttribute known = attributes.back().known;
+            if (known < KnownAttribute::count && known_attributes[size_t(known)] < 0)
+                known_attributes[size_t(known)] = int(attributes.size() - 1);
         }
 
         void add_attribute(const string& name, void* begin, size_t size) {
             add_attribute(name, begin, (uint8_t*)begin + size);
         }
+
+    private:
+        /// Index in attributes of each known attribute, -1 if absent
+        array<int, size_t(KnownAttribute::count)> known_attributes;
     };
 
     struct descriptors
@@ -335,7 +428,57 @@ namespace g3d
         // Line specific attributes 
         static constexpr const char* LineTangentIn = "g3d:vertex:tangent:0:float32:3";
         static constexpr const char* LineTangentOut = "g3d:vertex:tangent:1:float32:3";
+
+        // Obsolete names of the VIM 1.0 attributes
+        static constexpr const char* ObsoleteFaceGroupId = "g3d:face:groupid:0:int32:1";
+        static constexpr const char* ObsoleteGroupIndexOffset = "g3d:group:indexoffset:0:int32:1";
+        static constexpr const char* ObsoleteGroupVertexOffset = "g3d:group:vertexoffset:0:int32:1";
     };
+
+    inline const KnownDescriptor* find_known_descriptor(const string& name)
+    {
+        static const KnownDescriptor registry[] = {
+            { descriptors::Position, KnownAttribute::position, assoc_vertex, "position", 0, dt_float32, 3 },
+            { descriptors::Index, KnownAttribute::index, assoc_corner, "index", 0, dt_int32, 1 },
+            { descriptors::VertexUv, KnownAttribute::vertex_uv, assoc_vertex, "uv", 0, dt_float32, 2 },
+            { descriptors::VertexNormal, KnownAttribute::vertex_normal, assoc_vertex, "normal", 0, dt_float32, 3 },
+            { descriptors::VertexColorWithAlpha, KnownAttribute::vertex_color_with_alpha, assoc_vertex, "color", 0, dt_float32, 4 },
+            { descriptors::FaceMaterialId, KnownAttribute::face_material_id, assoc_face, "materialid", 0, dt_int32, 1 },
+            { descriptors::FaceGroup, KnownAttribute::face_group, assoc_face, "group", 0, dt_int32, 1 },
+            { descriptors::SubgeometryIndexOffset, KnownAttribute::subgeometry_index_offset, assoc_subgeometry, "indexoffset", 0, dt_int32, 1 },
+            { descriptors::SubgeometryVertexOffset, KnownAttribute::subgeometry_vertex_offset, assoc_subgeometry, "vertexoffset", 0, dt_int32, 1 },
+            { descriptors::InstanceTransform, KnownAttribute::instance_transform, assoc_instance, "transform", 0, dt_float32, 16 },
+            { descriptors::InstanceParent, KnownAttribute::instance_parent, assoc_instance, "parent", 0, dt_int32, 1 },
+            { descriptors::InstanceSubgeometry, KnownAttribute::instance_subgeometry, assoc_instance, "subgeometry", 0, dt_int32, 1 },
+            { descriptors::ObsoleteFaceGroupId, KnownAttribute::face_group, assoc_face, "groupid", 0, dt_int32, 1 },
+            { descriptors::ObsoleteGroupIndexOffset, KnownAttribute::subgeometry_index_offset, assoc_group, "indexoffset", 0, dt_int32, 1 },
+            { descriptors::ObsoleteGroupVertexOffset, KnownAttribute::subgeometry_vertex_offset, assoc_group, "vertexoffset", 0, dt_int32, 1 },
+        };
+
+        const KnownDescriptor* found = nullptr;
+        switch (descriptor_hash(name))
+        {
+            case descriptor_hash(descriptors::Position): found = &registry[0]; break;
+            case descriptor_hash(descriptors::Index): found = &registry[1]; break;
+            case descriptor_hash(descriptors::VertexUv): found = &registry[2]; break;
+            case descriptor_hash(descriptors::VertexNormal): found = &registry[3]; break;
+            case descriptor_hash(descriptors::VertexColorWithAlpha): found = &registry[4]; break;
+            case descriptor_hash(descriptors::FaceMaterialId): found = &registry[5]; break;
+            case descriptor_hash(descriptors::FaceGroup): found = &registry[6]; break;
+            case descriptor_hash(descriptors::SubgeometryIndexOffset): found = &registry[7]; break;
+            case descriptor_hash(descriptors::SubgeometryVertexOffset): found = &registry[8]; break;
+            case descriptor_hash(descriptors::InstanceTransform): found = &registry[9]; break;
+            case descriptor_hash(descriptors::InstanceParent): found = &registry[10]; break;
+            case descriptor_hash(descriptors::InstanceSubgeometry): found = &registry[11]; break;
+            case descriptor_hash(descriptors::ObsoleteFaceGroupId): found = &registry[12]; break;
+            case descriptor_hash(descriptors::ObsoleteGroupIndexOffset): found = &registry[13]; break;
+            case descriptor_hash(descriptors::ObsoleteGroupVertexOffset): found = &registry[14]; break;
+            default: return nullptr;
+        }
+
+        // Guard against hash collisions
+        return name == found->name ? found : nullptr;
+    }
 }
 
 #endif
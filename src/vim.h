@@ -12,6 +12,18 @@
 #include <unordered_map>
 #include <tuple>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define VIM_USE_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 #include "g3d.h"
 
@@ -36,15 +48,118 @@ namespace Vim
         int mValue;
     };
 
+    // A typed, read only, view over a column stored in the bfast data (the column isn't copied)
+    template <typename T>
+    class ColumnView
+    {
+    public:
+        ColumnView() {}
+
+        ColumnView(const T* begin, const T* end)
+            : mBegin(begin)
+            , mEnd(end)
+        {}
+
+        // Throw if the range doesn't contain a whole number of elements
+        explicit ColumnView(const bfast::ByteRange& range)
+            : mBegin((const T*)range.begin())
+            , mEnd((const T*)range.end())
+        {
+            if (range.size() % sizeof(T) != 0)
+                throw std::runtime_error("Column byte size does not divide evenly by size of elements");
+        }
+
+        const T* begin() const { return mBegin; }
+        const T* end() const { return mEnd; }
+        const T* data() const { return mBegin; }
+        size_t size() const { return mEnd - mBegin; }
+        bool empty() const { return mBegin == mEnd; }
+        const T& operator[](size_t index) const { return mBegin[index]; }
+
+        // View the same data as an other type of the same size (ex: int to an index enum)
+        template <typename U>
+        ColumnView<U> As() const
+        {
+            static_assert(sizeof(U) == sizeof(T), "Can only view as a type of the same size");
+            return ColumnView<U>((const U*)mBegin, (const U*)mEnd);
+        }
+
+    private:
+        const T* mBegin = nullptr;
+        const T* mEnd = nullptr;
+    };
+
     class EntityTable
     {
     public:
         std::string mName;
 
-        std::unordered_map<std::string, std::vector<int>> mIndexColumns;
-        std::unordered_map<std::string, std::vector<int>> mStringColumns;
-        std::unordered_map<std::string, std::vector<double>> mNumericColumns;
-        std::vector<SerializableProperty> mProperties;
+        // Columns point into the file data, the scene must outlive the table
+        std::unordered_map<std::string, ColumnView<int>> mIndexColumns;
+        std::unordered_map<std::string, ColumnView<int>> mStringColumns;
+        std::unordered_map<std::string, ColumnView<double>> mNumericColumns;
+        ColumnView<SerializableProperty> mProperties;
+
+        // Decodes an entity table from its bfast data
+        static EntityTable Decode(const std::string& tableName, const bfast::ByteRange& data)
+        {
+            EntityTable entityTable = { tableName };
+            bfast::Bfast tableBFast = bfast::Bfast::unpack(data);
+
+            for (auto k = 0; k < tableBFast.buffers.size(); ++k)
+            {
+                auto& tableBuffer = tableBFast.buffers[k];
+
+                if (tableBuffer.name == "properties")
+                {
+                    entityTable.mProperties = ColumnView<SerializableProperty>(tableBuffer.data);
+                }
+                else
+                {
+                    size_t index = tableBuffer.name.find_first_of(':');
+                    std::string type = tableBuffer.name.substr(0, index);
+                    std::string name = tableBuffer.name.substr(index + 1);
+
+                    if (type == "numeric")
+                    {
+                        entityTable.mNumericColumns[name] = ColumnView<double>(tableBuffer.data);
+                    }
+                    else if (type == "index")
+                    {
+                        entityTable.mIndexColumns[name] = ColumnView<int>(tableBuffer.data);
+                    }
+                    else if (type == "string")
+                    {
+                        entityTable.mStringColumns[name] = ColumnView<int>(tableBuffer.data);
+                    }
+                }
+            }
+            return entityTable;
+        }
+    };
+
+    // An entity table of the file, only its location is known until the first access decodes it.
+    class LazyEntityTable
+    {
+    public:
+        LazyEntityTable(const std::string& name, const bfast::ByteRange& data)
+            : mName(name)
+            , mData(data)
+        {}
+
+        // Returns the decoded table (thread safe, throw if the table data is invalid)
+        const EntityTable& Get() const
+        {
+            std::call_once(mDecoded, [this]() { mTable = EntityTable::Decode(mName, mData); });
+            return mTable;
+        }
+
+        const std::string mName;
+        const bfast::ByteRange mData;
+
+    private:
+        mutable std::once_flag mDecoded;
+        mutable EntityTable mTable;
     };
 
     inline std::vector<std::string> split(const std::string& str, const std::string& delim)
@@ -71,6 +186,159 @@ namespace Vim
         return tokens;
     }
 
+    // A read only view on a string of the strings table. The string is also zero terminated, so data() can be used as a C string
+    class StringView
+    {
+    public:
+        StringView() {}
+
+        StringView(const char* data, size_t size)
+            : mData(data)
+            , mSize(size)
+        {}
+
+        const char* data() const { return mData; }
+        size_t size() const { return mSize; }
+        bool empty() const { return mSize == 0; }
+        const char* begin() const { return mData; }
+        const char* end() const { return mData + mSize; }
+        char operator[](size_t index) const { return mData[index]; }
+
+        bool operator==(const StringView& other) const { return mSize == other.mSize && memcmp(mData, other.mData, mSize) == 0; }
+        bool operator!=(const StringView& other) const { return !(*this == other); }
+
+    private:
+        const char* mData = "";
+        size_t mSize = 0;
+    };
+
+    // Call onZero(offset) for each zero byte in [begin, end), in order
+    template <typename OnZero>
+    inline void ForEachZeroByte(const bfast::byte* begin, const bfast::byte* end, OnZero onZero)
+    {
+        const bfast::byte* data = begin;
+#if VIM_USE_SSE2
+        // Test 16 bytes at a time, most of the strings are short
+        const __m128i zero = _mm_setzero_si128();
+        for (; end - data >= 16; data += 16)
+        {
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)data), zero));
+            while (mask != 0)
+            {
+#ifdef _MSC_VER
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+#else
+                unsigned bit = (unsigned)__builtin_ctz(mask);
+#endif
+                onZero(size_t(data - begin) + bit);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; data < end; ++data)
+        {
+            if (*data == 0)
+                onZero(size_t(data - begin));
+        }
+    }
+
+    // Index of the zero terminated strings of the strings section, built in one pass. The bytes are split in chunks
+    // that can be indexed concurrently: Prepare, then IndexChunk for each chunk (in any order, on any thread), then Finish.
+    class StringTable
+    {
+    public:
+        size_t size() const { return mEntries.size(); }
+
+        StringView operator[](size_t index) const
+        {
+            const Entry& entry = mEntries[index];
+            return StringView((const char*)mData.begin() + entry.mOffset, entry.mLength);
+        }
+
+        // Index the strings in the calling thread
+        void Index(const bfast::ByteRange& data)
+        {
+            Prepare(data, 1);
+            IndexChunk(0);
+            Finish();
+        }
+
+        // Split data in chunks of at least minChunkSize bytes, return the number of chunks
+        size_t Prepare(const bfast::ByteRange& data, size_t minChunkSize = 1 << 20, size_t maxChunks = 64)
+        {
+            mData = data;
+            mEntries.clear();
+            size_t chunksCount = std::max<size_t>(1, std::min<size_t>(maxChunks, data.size() / std::max<size_t>(1, minChunkSize)));
+            mChunks.clear();
+            mChunks.resize(chunksCount);
+            for (size_t i = 0; i < chunksCount; ++i)
+            {
+                mChunks[i].mBegin = data.size() * i / chunksCount;
+                mChunks[i].mEnd = data.size() * (i + 1) / chunksCount;
+            }
+            return chunksCount;
+        }
+
+        // Index the strings ending in the chunk. The first one may start in a previous chunk, it is fixed by Finish
+        void IndexChunk(size_t chunkIndex)
+        {
+            Chunk& chunk = mChunks[chunkIndex];
+            size_t start = chunk.mBegin;
+            ForEachZeroByte(mData.begin() + chunk.mBegin, mData.begin() + chunk.mEnd, [&chunk, &start](size_t offset)
+            {
+                size_t zeroOffset = chunk.mBegin + offset;
+                chunk.mEntries.push_back({ start, zeroOffset - start });
+                start = zeroOffset + 1;
+            });
+            chunk.mTailStart = start;
+        }
+
+        // Join the chunks (throw if the last string isn't terminated)
+        void Finish()
+        {
+            size_t count = 0;
+            for (auto& chunk : mChunks)
+                count += chunk.mEntries.size();
+            mEntries.reserve(count);
+
+            size_t pendingStart = 0;
+            for (auto& chunk : mChunks)
+            {
+                if (!chunk.mEntries.empty())
+                {
+                    Entry& first = chunk.mEntries.front();
+                    first.mLength = first.mOffset + first.mLength - pendingStart;
+                    first.mOffset = pendingStart;
+                    pendingStart = chunk.mTailStart;
+                    mEntries.insert(mEntries.end(), chunk.mEntries.begin(), chunk.mEntries.end());
+                }
+            }
+            mChunks.clear();
+            if (pendingStart != mData.size())
+                throw std::runtime_error("Last string of the strings table isn't terminated");
+        }
+
+    private:
+        struct Entry
+        {
+            size_t mOffset;
+            size_t mLength;
+        };
+
+        struct Chunk
+        {
+            size_t mBegin = 0;
+            size_t mEnd = 0;
+            size_t mTailStart = 0;
+            std::vector<Entry> mEntries;
+        };
+
+        bfast::ByteRange mData = { nullptr, nullptr };
+        std::vector<Entry> mEntries;
+        std::vector<Chunk> mChunks;
+    };
+
     enum class VimErrorCodes
     {
         Success = 0,
@@ -82,24 +350,84 @@ namespace Vim
         EntityLoadingException = -6
     };
 
+    // Run all the jobs and return when they are all done, the jobs are independent and may run concurrently
+    typedef std::function<void(std::vector<std::function<void()>>& jobs)> JobsRunner;
+
+    // Default jobs runner, run the jobs one after the other in the calling thread
+    inline void RunJobsInOrder(std::vector<std::function<void()>>& jobs)
+    {
+        for (auto& job : jobs)
+            job();
+    }
+
     class Scene
     {
     public:
         static const uint32_t mVimHeaderFourCC = '1MIV'; // VIM1 encoded as uint32
         bfast::Bfast mBfast;
         bfast::Bfast mGeometryBFast;
-        bfast::Bfast mAssetsBFast;
         bfast::Bfast mEntitiesBFast;
-        std::vector<const bfast::byte*> mStrings;
+        StringTable mStrings;
         g3d::G3d mGeometry;
-        std::unordered_map<std::string, EntityTable> mEntityTables;
+        // Tables registry, filled before any table is decoded then only read, so it can be accessed by many threads
+        std::unordered_map<std::string, std::unique_ptr<LazyEntityTable>> mEntityTables;
         std::unordered_map<std::string, std::string> mHeader;
 
+        // Returns the entity table (decoded on first access), nullptr if the file hasn't this table
+        const EntityTable* GetEntityTable(const std::string& name) const
+        {
+            auto iterator = mEntityTables.find(name);
+            if (iterator == mEntityTables.end())
+                return nullptr;
+            return &iterator->second->Get();
+        }
+
+        // Returns the assets (their offsets table is unpacked on first access)
+        const bfast::Bfast& GetAssets() const
+        {
+            std::call_once(mAssetsUnpacked, [this]() {
+                if (mAssetsRange.size() != 0)
+                    mAssetsBFast = bfast::Bfast::unpack(mAssetsRange);
+            });
+            return mAssetsBFast;
+        }
+
         uint32_t mVersionMajor = 0xffffffff;
         uint32_t mVersionMinor = 0xffffffff;
         uint32_t mVersionPatch = 0xffffffff;
 
-        VimErrorCodes ReadFile(std::string fileName)
+        // Read the file, the geometry, the strings and the preloaded tables are decoded by jobs given to runJobs.
+        // Other tables are decoded on first access.
+        VimErrorCodes ReadFile(std::string fileName, const JobsRunner& runJobs = RunJobsInOrder, const std::vector<std::string>& preloadTables = {})
+        {
+            VimErrorCodes openResult = Open(fileName);
+            if (openResult != VimErrorCodes::Success)
+                return openResult;
+
+            // Each job writes its own result, the first error in jobs order is returned
+            std::vector<VimErrorCodes> jobsResults(2 + preloadTables.size(), VimErrorCodes::Success);
+            std::vector<std::function<void()>> jobs;
+            jobs.push_back([this, &jobsResults]() { jobsResults[0] = DecodeGeometry(); });
+            jobs.push_back([this, &jobsResults, &runJobs]() { jobsResults[1] = IndexStrings(runJobs); });
+
+            // Tables are independent, each one is decoded by it's own job
+            for (size_t i = 0; i < preloadTables.size(); ++i)
+                jobs.push_back([this, &jobsResults, &preloadTables, i]() { jobsResults[2 + i] = DecodeEntityTable(preloadTables[i]); });
+
+            runJobs(jobs);
+            for (VimErrorCodes jobResult : jobsResults)
+            {
+                if (jobResult != VimErrorCodes::Success)
+                    return jobResult;
+            }
+
+            DoneReading();
+            return VimErrorCodes::Success;
+        }
+
+        // Read the file header and locate the sections, nothing is decoded. Then the sections can be decoded in any
+        // order and concurrently: DecodeGeometry, IndexStrings and DecodeEntityTable, followed by DoneReading.
+        VimErrorCodes Open(std::string fileName)
         {
             try
             {
@@ -111,6 +439,9 @@ namespace Vim
                 return VimErrorCodes::FileNotRecognized;
             }
 
+            // Sections are decoded from start to end, then accessed by index during the conversion
+            mBfast.advise(bfast::Advice::sequential);
+
             for (auto i = 0; i < mBfast.buffers.size(); ++i)
             {
                 auto& b = mBfast.buffers[i];
@@ -193,90 +524,28 @@ namespace Vim
                 }
                 else if (b.name == "geometry")
                 {
-                    try
-                    {
-                        mGeometryBFast = bfast::Bfast::unpack(b.data);
-                        mGeometry = g3d::G3d(mGeometryBFast);
-                    }
-                    catch (std::exception& e)
-                    {
-                        (void)e;
-                        return Vim::VimErrorCodes::GeometryLoadingException;
-                    }
+                    mGeometryRange = b.data;
+                    mHasGeometry = true;
                 }
                 else if (b.name == "assets")
                 {
-                    try
-                    {
-                        mAssetsBFast = bfast::Bfast::unpack(b.data);
-                    }
-                    catch (std::exception& e)
-                    {
-                        (void)e;
+                    if (b.data.size() < bfast::header_size)
                         return Vim::VimErrorCodes::AssetLoadingException;
-                    }
+                    mAssetsRange = b.data;
                 }
                 else if (b.name == "strings")
                 {
-                    const bfast::byte* data = b.data.begin();
-                    size_t count = 0;
-                    while (data < b.data.end())
-                    {
-                        count++;
-                        data += strlen((const char*)data) + 1;
-                    }
-
-                    mStrings.resize(count);
-                    count = 0;
-                    data = b.data.begin();
-                    while (data < b.data.end())
-                    {
-                        mStrings[count++] = data;
-                        data += strlen((const char*)data) + 1;
-                    }
+                    mStringsRange = b.data;
+                    mHasStrings = true;
                 }
                 else if (b.name == "entities")
                 {
                     try
                     {
+                        // Only the tables offsets are read, tables are decoded when accessed
                         mEntitiesBFast = bfast::Bfast::unpack(b.data);
-                        for (auto j = 0; j < mEntitiesBFast.buffers.size(); ++j)
-                        {
-                            auto& entityBuffer = mEntitiesBFast.buffers[j];
-                            EntityTable entityTable = { entityBuffer.name };
-                            bfast::Bfast tableBFast = bfast::Bfast::unpack(entityBuffer.data);
-
-                            for (auto k = 0; k < tableBFast.buffers.size(); ++k)
-                            {
-                                auto& tableBuffer = tableBFast.buffers[k];
-
-                                if (tableBuffer.name == "properties")
-                                {
-                                    entityTable.mProperties = std::vector<SerializableProperty>((SerializableProperty*)tableBuffer.data.begin(), (SerializableProperty*)tableBuffer.data.end());
-                                }
-                                else
-                                {
-                                    size_t index = tableBuffer.name.find_first_of(':');
-                                    std::string type = tableBuffer.name.substr(0, index);
-                                    std::string name = tableBuffer.name.substr(index + 1);
-
-                                    if (type == "numeric")
-                                    {
-                                        entityTable.mNumericColumns[name] = std::vector<double>((double*)tableBuffer.data.begin(), (double*)tableBuffer.data.end());
-                                    }
-                                    else if (type == "index")
-                                    {
-                                        entityTable.mIndexColumns[name] = std::vector<int>((int*)tableBuffer.data.begin(), (int*)tableBuffer.data.end());
-                                    }
-                                    else if (type == "string")
-                                    {
-                                        entityTable.mStringColumns[name] = std::vector<int>((int*)tableBuffer.data.begin(), (int*)tableBuffer.data.end());
-                                    }
-                                }
-                            }
-
-                            mEntityTables[entityTable.mName] = entityTable;
-                        }
+                        for (auto& entityBuffer : mEntitiesBFast.buffers)
+                            mEntityTables[entityBuffer.name].reset(new LazyEntityTable(entityBuffer.name, entityBuffer.data));
                     }
                     catch (std::exception& e)
                     {
@@ -285,8 +554,82 @@ namespace Vim
                     }
                 }
             }
+
+            return VimErrorCodes::Success;
+        }
+
+        // Decode the geometry section (if the file has one)
+        VimErrorCodes DecodeGeometry()
+        {
+            if (!mHasGeometry)
+                return VimErrorCodes::Success;
+            try
+            {
+                mGeometryBFast = bfast::Bfast::unpack(mGeometryRange);
+                mGeometry = g3d::G3d(mGeometryBFast);
+            }
+            catch (std::exception& e)
+            {
+                (void)e;
+                return VimErrorCodes::GeometryLoadingException;
+            }
+            return VimErrorCodes::Success;
+        }
+
+        // Index the strings section (if the file has one), chunks are indexed by jobs given to runJobs
+        VimErrorCodes IndexStrings(const JobsRunner& runJobs = RunJobsInOrder)
+        {
+            if (!mHasStrings)
+                return VimErrorCodes::Success;
+            try
+            {
+                std::vector<std::function<void()>> jobs;
+                size_t chunksCount = mStrings.Prepare(mStringsRange);
+                for (size_t chunkIndex = 0; chunkIndex < chunksCount; ++chunkIndex)
+                    jobs.push_back([this, chunkIndex]() { mStrings.IndexChunk(chunkIndex); });
+                runJobs(jobs);
+                mStrings.Finish();
+            }
+            catch (std::exception& e)
+            {
+                (void)e;
+                return VimErrorCodes::Failed;
+            }
             return VimErrorCodes::Success;
         }
+
+        // Decode the entity table now instead of on first access (nothing to do if the file hasn't this table)
+        VimErrorCodes DecodeEntityTable(const std::string& name) const
+        {
+            auto iterator = mEntityTables.find(name);
+            if (iterator == mEntityTables.end())
+                return VimErrorCodes::Success;
+            try
+            {
+                iterator->second->Get();
+            }
+            catch (std::exception& e)
+            {
+                (void)e;
+                return VimErrorCodes::EntityLoadingException;
+            }
+            return VimErrorCodes::Success;
+        }
+
+        // All sections needed were decoded, the file will now be accessed by index
+        void DoneReading()
+        {
+            mBfast.advise(bfast::Advice::random);
+        }
+
+    private:
+        bfast::ByteRange mGeometryRange = { nullptr, nullptr };
+        bfast::ByteRange mStringsRange = { nullptr, nullptr };
+        bool mHasGeometry = false;
+        bool mHasStrings = false;
+        bfast::ByteRange mAssetsRange = { nullptr, nullptr };
+        mutable std::once_flag mAssetsUnpacked;
+        mutable bfast::Bfast mAssetsBFast;
     };
 
 }